@@ -10,6 +10,8 @@
 
 #define UTF_INVALID 0xFFFD
 #define UTF_SIZ     4
+#define ASTRALSIZE  256
+#define MAXFONTS    16 /* fallbacks stop growing a fontset past this */
 
 static const unsigned char utfbyte[UTF_SIZ + 1] = {0x80,    0, 0xC0, 0xE0, 0xF0};
 static const unsigned char utfmask[UTF_SIZ + 1] = {0xC0, 0x80, 0xE0, 0xF0, 0xF8};
@@ -71,6 +73,8 @@ drw_create(Display *dpy, int screen, Window root, unsigned int w, unsigned int h
 	drw->w = w;
 	drw->h = h;
 	drw->drawable = XCreatePixmap(dpy, root, w, h, DefaultDepth(dpy, screen));
+	drw->xftdraw = XftDrawCreate(dpy, drw->drawable, DefaultVisual(dpy, screen),
+	                             DefaultColormap(dpy, screen));
 	drw->gc = XCreateGC(dpy, root, 0, NULL);
 	XSetLineAttributes(dpy, drw->gc, 1, LineSolid, CapButt, JoinMiter);
 
@@ -88,11 +92,19 @@ drw_resize(Drw *drw, unsigned int w, unsigned int h)
 	if (drw->drawable)
 		XFreePixmap(drw->dpy, drw->drawable);
 	drw->drawable = XCreatePixmap(drw->dpy, drw->root, w, h, DefaultDepth(drw->dpy, drw->screen));
+	XftDrawChange(drw->xftdraw, drw->drawable);
 }
 
 void
 drw_free(Drw *drw)
 {
+	size_t i;
+
+	for (i = 0; i < WCACHESIZE; i++)
+		free(drw->wcache[i].text);
+	for (i = 0; i < 256; i++)
+		free(drw->fontmap[i]);
+	XftDrawDestroy(drw->xftdraw);
 	XFreePixmap(drw->dpy, drw->drawable);
 	XFreeGC(drw->dpy, drw->gc);
 	free(drw);
@@ -144,14 +156,52 @@ xfont_create(Drw *drw, const char *fontname, FcPattern *fontpattern)
 static void
 xfont_free(Fnt *font)
 {
+	size_t i;
+
 	if (!font)
 		return;
+	for (i = 0; i < 256; i++)
+		free(font->adv[i]);
+	free(font->astral);
 	if (font->pattern)
 		FcPatternDestroy(font->pattern);
 	XftFontClose(font->dpy, font->xfont);
 	free(font);
 }
 
+/* Horizontal advance of one codepoint, asked of Xft only the first time. */
+static unsigned int
+xfont_advance(Fnt *font, long cp)
+{
+	XGlyphInfo ext;
+	FT_UInt glyph;
+	unsigned short *page = NULL;
+	Adv *a = NULL;
+
+	if (cp < 0x10000) {
+		if (!(page = font->adv[cp >> 8]))
+			page = font->adv[cp >> 8] = ecalloc(256, sizeof(unsigned short));
+		if (page[cp & 0xff])
+			return page[cp & 0xff] - 1;
+	} else {
+		if (!font->astral)
+			font->astral = ecalloc(ASTRALSIZE, sizeof(Adv));
+		a = &font->astral[cp & (ASTRALSIZE - 1)];
+		if (a->cp == cp)
+			return a->adv;
+	}
+
+	glyph = XftCharIndex(font->dpy, font->xfont, cp);
+	XftGlyphExtents(font->dpy, font->xfont, &glyph, 1, &ext);
+	if (page)
+		page[cp & 0xff] = ext.xOff + 1;
+	else {
+		a->cp = cp;
+		a->adv = ext.xOff;
+	}
+	return ext.xOff;
+}
+
 Fnt*
 drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount)
 {
@@ -234,23 +284,129 @@ drw_rect(Drw *drw, int x, int y, unsigned int w, unsigned int h, int filled, int
 		XDrawRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w - 1, h - 1);
 }
 
+static int
+xfont_same(XftFont *a, XftFont *b)
+{
+	FcChar8 *fa, *fb;
+	int ia, ib;
+
+	if (a == b)
+		return 1;
+	return FcPatternGetString(a->pattern, FC_FILE, 0, &fa) == FcResultMatch &&
+	       FcPatternGetString(b->pattern, FC_FILE, 0, &fb) == FcResultMatch &&
+	       FcPatternGetInteger(a->pattern, FC_INDEX, 0, &ia) == FcResultMatch &&
+	       FcPatternGetInteger(b->pattern, FC_INDEX, 0, &ib) == FcResultMatch &&
+	       !strcmp((char *)fa, (char *)fb) && ia == ib;
+}
+
+/* Ask fontconfig for a font covering cp and append it to the fontset,
+ * unless the set is full or already holds that face. */
+static Fnt *
+xfont_fallback(Drw *drw, long cp)
+{
+	Fnt *font, *cur;
+	FcCharSet *fccharset;
+	FcPattern *fcpattern;
+	FcPattern *match;
+	XftResult result;
+	int n;
+
+	for (n = 1, cur = drw->fonts; cur->next; cur = cur->next, n++)
+		; /* NOP */
+	if (n >= MAXFONTS)
+		return NULL;
+
+	if (!drw->fonts->pattern) {
+		/* Refer to the comment in xfont_create for more information. */
+		die("the first font in the cache must be loaded from a font string.");
+	}
+
+	fccharset = FcCharSetCreate();
+	FcCharSetAddChar(fccharset, cp);
+
+	fcpattern = FcPatternDuplicate(drw->fonts->pattern);
+	FcPatternAddCharSet(fcpattern, FC_CHARSET, fccharset);
+	FcPatternAddBool(fcpattern, FC_SCALABLE, FcTrue);
+
+	FcConfigSubstitute(NULL, fcpattern, FcMatchPattern);
+	FcDefaultSubstitute(fcpattern);
+	match = XftFontMatch(drw->dpy, drw->screen, fcpattern, &result);
+
+	FcCharSetDestroy(fccharset);
+	FcPatternDestroy(fcpattern);
+
+	if (!match)
+		return NULL;
+	if (!(font = xfont_create(drw, NULL, match)))
+		return NULL;
+	if (!XftCharExists(drw->dpy, font->xfont, cp)) {
+		xfont_free(font);
+		return NULL;
+	}
+	for (cur = drw->fonts; cur; cur = cur->next) {
+		if (xfont_same(cur->xfont, font->xfont)) {
+			xfont_free(font);
+			return NULL;
+		}
+	}
+	cur = drw->fonts;
+	while (cur->next)
+		cur = cur->next;
+	cur->next = font;
+	return font;
+}
+
+/* Font to draw cp with. Answers, including "nothing has it" which maps to
+ * the primary font, are remembered until the fontset changes. */
+static Fnt *
+drw_font_for(Drw *drw, long cp)
+{
+	Fnt *font, **slot;
+	size_t i;
+
+	if (drw->mapfonts != drw->fonts) {
+		for (i = 0; i < 256; i++)
+			if (drw->fontmap[i])
+				memset(drw->fontmap[i], 0, 256 * sizeof(Fnt *));
+		memset(drw->fontmapx, 0, sizeof(drw->fontmapx));
+		drw->mapfonts = drw->fonts;
+	}
+
+	if (cp < 0x10000) {
+		if (!drw->fontmap[cp >> 8])
+			drw->fontmap[cp >> 8] = ecalloc(256, sizeof(Fnt *));
+		slot = &drw->fontmap[cp >> 8][cp & 0xff];
+	} else {
+		i = cp & (FONTMAPSIZE - 1);
+		if (drw->fontmapx[i].cp != cp) {
+			drw->fontmapx[i].cp = cp;
+			drw->fontmapx[i].font = NULL;
+		}
+		slot = &drw->fontmapx[i].font;
+	}
+	if (*slot)
+		return *slot;
+
+	for (font = drw->fonts; font; font = font->next)
+		if (XftCharExists(drw->dpy, font->xfont, cp))
+			break;
+	if (!font && !(font = xfont_fallback(drw, cp)))
+		font = drw->fonts;
+	return (*slot = font);
+}
+
 int
 drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lpad, const char *text, int invert)
 {
 	char buf[1024];
-	int ty;
-	unsigned int ew;
-	XftDraw *d = NULL;
-	Fnt *usedfont, *curfont, *nextfont;
-	size_t i, len;
+	XftGlyphFontSpec specs[1024];
+	int ty, nspecs = 0;
+	unsigned int ew, gx;
+	Fnt *usedfont, *curfont;
+	size_t i, n, len;
 	int utf8strlen, utf8charlen, render = x || y || w || h;
 	long utf8codepoint = 0;
 	const char *utf8str;
-	FcCharSet *fccharset;
-	FcPattern *fcpattern;
-	FcPattern *match;
-	XftResult result;
-	int charexists = 0;
 
 	if (!drw || (render && !drw->scheme) || !text || !drw->fonts)
 		return 0;
@@ -260,9 +416,6 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 	} else {
 		XSetForeground(drw->dpy, drw->gc, drw->scheme[invert ? ColFg : ColBg].pixel);
 		XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h);
-		d = XftDrawCreate(drw->dpy, drw->drawable,
-		                  DefaultVisual(drw->dpy, drw->screen),
-		                  DefaultColormap(drw->dpy, drw->screen));
 		x += lpad;
 		w -= lpad;
 	}
@@ -271,26 +424,13 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 	while (1) {
 		utf8strlen = 0;
 		utf8str = text;
-		nextfont = NULL;
+		curfont = usedfont;
 		while (*text) {
 			utf8charlen = utf8decode(text, &utf8codepoint, UTF_SIZ);
-			for (curfont = drw->fonts; curfont; curfont = curfont->next) {
-				charexists = charexists || XftCharExists(drw->dpy, curfont->xfont, utf8codepoint);
-				if (charexists) {
-					if (curfont == usedfont) {
-						utf8strlen += utf8charlen;
-						text += utf8charlen;
-					} else {
-						nextfont = curfont;
-					}
-					break;
-				}
-			}
-
-			if (!charexists || nextfont)
+			if ((curfont = drw_font_for(drw, utf8codepoint)) != usedfont)
 				break;
-			else
-				charexists = 0;
+			utf8strlen += utf8charlen;
+			text += utf8charlen;
 		}
 
 		if (utf8strlen) {
@@ -307,59 +447,36 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 						; /* NOP */
 
 				if (render) {
+					/* queue the run, all runs go out in one request below */
 					ty = y + (h - usedfont->h) / 2 + usedfont->xfont->ascent;
-					XftDrawStringUtf8(d, &drw->scheme[invert ? ColBg : ColFg],
-					                  usedfont->xfont, x, ty, (XftChar8 *)buf, len);
+					for (i = 0, gx = x; i < len; i += n) {
+						if (!(n = utf8decode(buf + i, &utf8codepoint, len - i)))
+							break;
+						if (nspecs == sizeof(specs) / sizeof(specs[0])) {
+							XftDrawGlyphFontSpec(drw->xftdraw, &drw->scheme[invert ? ColBg : ColFg],
+							                     specs, nspecs);
+							nspecs = 0;
+						}
+						specs[nspecs].font = usedfont->xfont;
+						specs[nspecs].glyph = XftCharIndex(drw->dpy, usedfont->xfont, utf8codepoint);
+						specs[nspecs].x = gx;
+						specs[nspecs].y = ty;
+						gx += xfont_advance(usedfont, utf8codepoint);
+						nspecs++;
+					}
 				}
 				x += ew;
 				w -= ew;
 			}
 		}
 
-		if (!*text) {
+		if (!*text)
 			break;
-		} else if (nextfont) {
-			charexists = 0;
-			usedfont = nextfont;
-		} else {
-			/* Regardless of whether or not a fallback font is found, the
-			 * character must be drawn. */
-			charexists = 1;
-
-			fccharset = FcCharSetCreate();
-			FcCharSetAddChar(fccharset, utf8codepoint);
-
-			if (!drw->fonts->pattern) {
-				/* Refer to the comment in xfont_create for more information. */
-				die("the first font in the cache must be loaded from a font string.");
-			}
-
-			fcpattern = FcPatternDuplicate(drw->fonts->pattern);
-			FcPatternAddCharSet(fcpattern, FC_CHARSET, fccharset);
-			FcPatternAddBool(fcpattern, FC_SCALABLE, FcTrue);
-
-			FcConfigSubstitute(NULL, fcpattern, FcMatchPattern);
-			FcDefaultSubstitute(fcpattern);
-			match = XftFontMatch(drw->dpy, drw->screen, fcpattern, &result);
-
-			FcCharSetDestroy(fccharset);
-			FcPatternDestroy(fcpattern);
-
-			if (match) {
-				usedfont = xfont_create(drw, NULL, match);
-				if (usedfont && XftCharExists(drw->dpy, usedfont->xfont, utf8codepoint)) {
-					for (curfont = drw->fonts; curfont->next; curfont = curfont->next)
-						; /* NOP */
-					curfont->next = usedfont;
-				} else {
-					xfont_free(usedfont);
-					usedfont = drw->fonts;
-				}
-			}
-		}
+		usedfont = curfont;
 	}
-	if (d)
-		XftDrawDestroy(d);
+	if (nspecs)
+		XftDrawGlyphFontSpec(drw->xftdraw, &drw->scheme[invert ? ColBg : ColFg],
+		                     specs, nspecs);
 
 	return x + (render ? w : 0);
 }
@@ -371,28 +488,61 @@ drw_map(Drw *drw, Window win, int x, int y, unsigned int w, unsigned int h)
 		return;
 
 	XCopyArea(drw->dpy, drw->drawable, win, drw->gc, x, y, w, h, x, y);
-	XSync(drw->dpy, False);
 }
 
 unsigned int
 drw_fontset_getwidth(Drw *drw, const char *text)
 {
+	WidthCache *wc, *lru;
+	unsigned long hash = 2166136261UL;
+	const char *s;
+	size_t i, len;
+
 	if (!drw || !drw->fonts || !text)
 		return 0;
-	return drw_text(drw, 0, 0, 0, 0, 0, text, 0);
+
+	for (s = text; *s; s++)
+		hash = ((hash ^ (unsigned char)*s) * 16777619UL) & 0xffffffffUL;
+	len = s - text;
+	lru = &drw->wcache[0];
+	for (i = 0; i < WCACHESIZE; i++) {
+		wc = &drw->wcache[i];
+		if (wc->text && wc->hash == hash && wc->fonts == drw->fonts &&
+		    !strcmp(wc->text, text)) {
+			wc->age = ++drw->wage;
+			return wc->w;
+		}
+		if (wc->age < lru->age)
+			lru = wc;
+	}
+
+	free(lru->text);
+	lru->text = ecalloc(len + 1, 1);
+	memcpy(lru->text, text, len);
+	lru->hash = hash;
+	lru->fonts = drw->fonts;
+	lru->age = ++drw->wage;
+	return (lru->w = drw_text(drw, 0, 0, 0, 0, 0, text, 0));
 }
 
 void
 drw_font_getexts(Fnt *font, const char *text, unsigned int len, unsigned int *w, unsigned int *h)
 {
-	XGlyphInfo ext;
+	unsigned int ew = 0;
+	size_t n;
+	long cp;
 
 	if (!font || !text)
 		return;
 
-	XftTextExtentsUtf8(font->dpy, font->xfont, (XftChar8 *)text, len, &ext);
+	/* Xft does not kern, so the advances simply add up */
+	while (len && (n = utf8decode(text, &cp, len))) {
+		ew += xfont_advance(font, cp);
+		text += n;
+		len -= n;
+	}
 	if (w)
-		*w = ext.xOff;
+		*w = ew;
 	if (h)
 		*h = font->h;
 }
@@ -4,26 +4,54 @@ typedef struct {
 	Cursor cursor;
 } Cur;
 
+typedef struct {
+	long cp;
+	unsigned int adv;
+} Adv;
+
 typedef struct Fnt {
 	Display *dpy;
 	unsigned int h;
 	XftFont *xfont;
 	FcPattern *pattern;
+	unsigned short *adv[256]; /* BMP glyph advances + 1, in pages of 256 */
+	Adv *astral;              /* advances beyond the BMP, direct mapped */
 	struct Fnt *next;
 } Fnt;
 
 enum { ColFg, ColBg }; /* Clr scheme index */
 typedef XftColor Clr;
 
+#define WCACHESIZE  64
+#define FONTMAPSIZE 256
+
+typedef struct {
+	Fnt *fonts;
+	unsigned long hash;
+	char *text;
+	unsigned int w, age;
+} WidthCache;
+
+typedef struct {
+	long cp;
+	Fnt *font;
+} FontMap;
+
 typedef struct {
 	unsigned int w, h;
 	Display *dpy;
 	int screen;
 	Window root;
 	Drawable drawable;
+	XftDraw *xftdraw;
 	GC gc;
 	Clr *scheme;
 	Fnt *fonts;
+	WidthCache wcache[WCACHESIZE]; /* string widths, least recently used goes */
+	unsigned int wage;
+	Fnt **fontmap[256];          /* BMP codepoint -> font, in pages of 256 */
+	FontMap fontmapx[FONTMAPSIZE]; /* beyond the BMP, direct mapped */
+	Fnt *mapfonts;               /* fontset the maps were built for */
 } Drw;
 
 /* Drawable abstraction */
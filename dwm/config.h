@@ -6,8 +6,10 @@ static const unsigned int gappx     = 14;       /* gap pixel between windows */
 static const unsigned int snap      = 12;       /* snap pixel */
 static const int showbar            = 1;        /* 0 means no bar */
 static const int topbar             = 0;        /* 0 means bottom bar */
+static const int layoutstats        = 0;        /* 1 means print X requests per layout pass */
 static const int tbpad              = 16;       /* sum of top and bottom padding for text */
 static const int lrpad              = 34;       /* sum of left and right padding for text */
+static const char statussep         = '\n';    /* splits the status text into blocks */
 static const char *fonts[]          = {
 	"Font Awesome 5 Free:style=Solid:pixelsize=16:hintstyle=hintslight",
 	"Ubuntu:pixelsize=16",
@@ -128,3 +130,25 @@ static Button buttons[] = {
 	{ ClkTagBar,            MODKEY,         Button1,        tag,            {0} },
 	{ ClkTagBar,            MODKEY,         Button3,        toggletag,      {0} },
 };
+
+/* IPC, see dwm(1) */
+static const int ipcsocket = 1; /* 0 means no IPC socket */
+static const IpcCommand ipccommands[] = {
+	/* name             function        argument */
+	{ "view",           view,           IpcArgUint },
+	{ "toggleview",     toggleview,     IpcArgUint },
+	{ "tag",            tag,            IpcArgUint },
+	{ "toggletag",      toggletag,      IpcArgUint },
+	{ "tagmon",         tagmon,         IpcArgInt },
+	{ "focusmon",       focusmon,       IpcArgInt },
+	{ "focusstack",     focusstack,     IpcArgInt },
+	{ "incnmaster",     incnmaster,     IpcArgInt },
+	{ "setmfact",       setmfact,       IpcArgFloat },
+	{ "setlayout",      setlayout,      IpcArgLayout },
+	{ "togglebar",      togglebar,      IpcArgNone },
+	{ "togglefloating", togglefloating, IpcArgNone },
+	{ "zoom",           zoom,           IpcArgNone },
+	{ "killclient",     killclient,     IpcArgNone },
+	{ "restart",        restart,        IpcArgNone },
+	{ "quit",           quit,           IpcArgNone },
+};
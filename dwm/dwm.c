@@ -20,7 +20,9 @@
  *
  * To understand everything else, start reading main().
  */
+#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <locale.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -29,6 +31,9 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <sys/stat.h>
 #include <X11/cursorfont.h>
@@ -40,6 +45,9 @@
 #ifdef XINERAMA
 #include <X11/extensions/Xinerama.h>
 #endif /* XINERAMA */
+#ifdef XCB
+#include <X11/Xlib-xcb.h>
+#endif /* XCB */
 #include <X11/Xft/Xft.h>
 
 #include "drw.h"
@@ -64,9 +72,17 @@ enum { SchemeNorm, SchemeSel }; /* color schemes */
 enum { NetSupported, NetWMName, NetWMState, NetWMCheck,
        NetWMFullscreen, NetActiveWindow, NetWMWindowType,
        NetWMWindowTypeDialog, NetClientList, NetLast }; /* EWMH atoms */
-enum { WMProtocols, WMDelete, WMState, WMTakeFocus, WMLast }; /* default atoms */
+enum { WMProtocols, WMDelete, WMState, WMTakeFocus, WMDwmState, WMLast }; /* default atoms */
 enum { ClkTagBar, ClkLtSymbol, ClkStatusText, ClkWinTitle,
        ClkClientWin, ClkRootWin, ClkLast }; /* clicks */
+enum { DirtyLayout = 1, DirtyStack = 2, DirtyBar = 4,
+       DirtyStatus = 8 }; /* deferred work */
+enum { EvTags = 1, EvLayout = 2, EvFocus = 4, EvMonitor = 8,
+       EvAll = 15 }; /* IPC events */
+enum { IpcArgNone, IpcArgInt, IpcArgUint, IpcArgFloat,
+       IpcArgLayout }; /* IPC command arguments */
+enum { PfTransient, PfNetName, PfName, PfNetState, PfNetType, PfClass,
+       PfNormalHints, PfHints, PfState, PfLast }; /* prefetched properties */
 
 typedef union {
 	int i;
@@ -90,6 +106,8 @@ struct Client {
 	float mina, maxa;
 	int x, y, w, h;
 	int oldx, oldy, oldw, oldh;
+	int ax, ay, aw, ah, abw; /* geometry last sent to the server */
+	int resized;             /* owes the client a ConfigureNotify */
 	int basew, baseh, incw, inch, maxw, maxh, minw, minh;
 	int bw, oldbw;
 	unsigned int tags;
@@ -117,6 +135,7 @@ struct Monitor {
 	float mfact;
 	int nmaster;
 	int num;
+	int dirty;            /* Dirty* work left for refresh() */
 	int by;               /* bar geometry */
 	int mx, my, mw, mh;   /* screen size */
 	int wx, wy, ww, wh;   /* window area  */
@@ -131,8 +150,32 @@ struct Monitor {
 	Monitor *next;
 	Window barwin;
 	const Layout *lt[2];
+	unsigned int pubtags[3]; /* tags, occupied, urgent as last sent over IPC */
+	char publt[16];
 };
 
+typedef struct {
+	const char *name;
+	void (*func)(const Arg *);
+	int arg; /* IpcArg* */
+} IpcCommand;
+
+typedef struct {
+	int fd;
+	unsigned int subs; /* Ev* */
+	size_t len;
+	char buf[512];
+} IpcClient;
+
+typedef struct {
+	Window win;
+	int mon;
+	unsigned int tags;
+	int isfloating;
+	int x, y, w, h, oldbw;
+	int order, stackorder;
+} SavedClient;
+
 typedef struct {
 	const char *class;
 	const char *instance;
@@ -142,7 +185,64 @@ typedef struct {
 	int monitor;
 } Rule;
 
+typedef struct {
+	Window win;
+	Client *c; /* NULL for bar windows */
+	Monitor *m;
+} WinEntry;
+
+enum { StText, StFg, StBg, StReset, StRect, StGraph }; /* status ops */
+
+#ifdef XCB
+typedef struct {
+	Window win;
+	xcb_get_window_attributes_reply_t *attr;
+	xcb_get_geometry_reply_t *geom;
+	xcb_get_property_reply_t *prop[PfLast];
+} Prefetch;
+#endif /* XCB */
+
+typedef struct {
+	char name[16];
+	int v[256];           /* ring buffer, v[head] is written next */
+	int head;
+	unsigned int n;       /* values appended so far */
+	Pixmap pix;           /* columns drawn by drawgraph() */
+	int pw, ph, pmax;
+	unsigned long pfg, pbg;
+	unsigned int pn;      /* n when pix was drawn */
+} Series;
+
+typedef struct {
+	int type;
+	int x, y, w, h;
+	int invert;
+	int max;              /* StGraph scale, 0 to fit */
+	const char *text;
+	Clr *clr;
+	Series *series;
+} StatusOp;
+
+typedef struct {
+	char *text;     /* as received, codes included */
+	char *buf;      /* text with codes cut out, ops point here */
+	StatusOp *ops;
+	int nops;
+	int w;
+	int stale;      /* pix does not show text yet */
+	Pixmap pix;
+	int pw;
+} StatusBlock;
+
+typedef struct StatusColor StatusColor;
+struct StatusColor {
+	char name[8];
+	Clr clr;
+	StatusColor *next;
+};
+
 /* function declarations */
+static void applygeom(Client *c);
 static void applyrules(Client *c);
 static int applysizehints(Client *c, int *x, int *y, int *w, int *h, int interact);
 static void arrange(Monitor *m);
@@ -154,6 +254,7 @@ static void checkotherwm(void);
 static void cleanup(void);
 static void cleanupmon(Monitor *mon);
 static void clientmessage(XEvent *e);
+static void compilestatus(StatusBlock *b);
 static void configure(Client *c);
 static void configurenotify(XEvent *e);
 static void configurerequest(XEvent *e);
@@ -163,23 +264,42 @@ static void detach(Client *c);
 static void detachstack(Client *c);
 static Monitor *dirtomon(int dir);
 static void drawbar(Monitor *m);
-static int drawstatusbar(Monitor *m, int bh, char* text);
+static int drawstatusbar(Monitor *m, int partial);
 static void drawbars(void);
+static void drawgraph(StatusOp *op, int x);
 static void enternotify(XEvent *e);
 static void expose(XEvent *e);
 static void focus(Client *c);
 static void focusin(XEvent *e);
 static void focusmon(const Arg *arg);
 static void focusstack(const Arg *arg);
+static int getattrs(Window w, XWindowAttributes *wa);
+static void getclass(Window w, char *instance, char *class, unsigned int size);
 static char *getdwmpath(void);
+static XWMHints *gethints(Window w);
+static int getnormalhints(Window w, XSizeHints *size);
 static int getrootptr(int *x, int *y);
 static long getstate(Window w);
 static int gettextprop(Window w, Atom atom, char *text, unsigned int size);
+static int gettransient(Window w, Window *trans);
 static void grabbuttons(Client *c, int focused);
 static void grabkeys(void);
 static void incnmaster(const Arg *arg);
+static void ipccleanup(void);
+static void ipcclose(IpcClient *cl);
+static void ipcevent(IpcClient *to, unsigned int ev, const char *fmt, ...);
+static int ipcfds(fd_set *fds, int maxfd);
+static void ipchandle(fd_set *fds);
+static void ipcinit(void);
+static size_t ipcline(char *buf, size_t size, const char *fmt, va_list ap);
+static void ipcnotify(IpcClient *to);
+static void ipcquery(IpcClient *cl, const char *what);
+static void ipcrequest(IpcClient *cl, char *line);
+static void ipcsend(IpcClient *cl, const char *fmt, ...);
+static void ipcwrite(IpcClient *cl, const char *buf, size_t len);
 static void keypress(XEvent *e);
 static void killclient(const Arg *arg);
+static void loadstate(void);
 static void manage(Window w, XWindowAttributes *wa);
 static void mappingnotify(XEvent *e);
 static void maprequest(XEvent *e);
@@ -188,18 +308,35 @@ static void motionnotify(XEvent *e);
 static void movemouse(const Arg *arg);
 static Client *nexttiled(Client *c);
 static void pop(Client *);
+static void prefetch(Window *wins, unsigned int n);
+static void prefetchfree(void);
+#ifdef XCB
+static int prefetched(Window w, Atom atom, xcb_get_property_reply_t **r);
+static Prefetch *prefetchwin(Window w);
+#endif /* XCB */
 static void propertynotify(XEvent *e);
 static void quit(const Arg *arg);
 static Monitor *recttomon(int x, int y, int w, int h);
+static void refresh(void);
+static void renderbar(Monitor *m);
+static void renderblock(StatusBlock *b, int x);
 static void resize(Client *c, int x, int y, int w, int h, int interact);
 static void resizeclient(Client *c, int x, int y, int w, int h);
 static void resizemouse(const Arg *arg);
 static void restack(Monitor *m);
+static void restackmon(Monitor *m);
 static void restart(const Arg *arg);
+static void restoreorder(void);
 static void run(void);
+static SavedClient *savedclient(Window w);
+static void savestate(void);
 static void scan(void);
 static int sendevent(Client *c, Atom proto);
 static void sendmon(Client *c, Monitor *m);
+static void seriesappend(Series *sr, int v);
+static Series *seriesget(const char *name, int create);
+static int seriesval(Series *sr, int i);
+static int setblock(int i, const char *text);
 static void setclientstate(Client *c, long state);
 static void setfocus(Client *c);
 static void setfullscreen(Client *c, int fullscreen);
@@ -210,6 +347,11 @@ static void seturgent(Client *c, int urg);
 static void showhide(Client *c);
 static void sigchld(int unused);
 static void spawn(const Arg *arg);
+static void statusappends(char *text);
+static char *statusargs(char *s, int *v, int n);
+static void statuschanged(int moved);
+static Clr *statuscolor(const char *name);
+static StatusOp *statusop(int type);
 static void tag(const Arg *arg);
 static void tagmon(const Arg *arg);
 static void tile(Monitor *);
@@ -231,6 +373,10 @@ static void updatetitle(Client *c);
 static void updatewindowtype(Client *c);
 static void updatewmhints(Client *c);
 static void view(const Arg *arg);
+static unsigned int winhash(Window w);
+static void winmapdel(Window w);
+static WinEntry *winmapget(Window w);
+static void winmapset(Window w, Client *c, Monitor *m);
 static Client *wintoclient(Window w);
 static Monitor *wintomon(Window w);
 static int xerror(Display *dpy, XErrorEvent *ee);
@@ -241,7 +387,32 @@ static void zoom(const Arg *arg);
 
 /* variables */
 static const char broken[] = "broken";
+static char *wmatomnames[WMLast] = {
+	[WMProtocols] = "WM_PROTOCOLS",
+	[WMDelete] = "WM_DELETE_WINDOW",
+	[WMState] = "WM_STATE",
+	[WMTakeFocus] = "WM_TAKE_FOCUS",
+	[WMDwmState] = "_DWM_STATE",
+};
+static char *netatomnames[NetLast] = {
+	[NetSupported] = "_NET_SUPPORTED",
+	[NetWMName] = "_NET_WM_NAME",
+	[NetWMState] = "_NET_WM_STATE",
+	[NetWMCheck] = "_NET_SUPPORTING_WM_CHECK",
+	[NetWMFullscreen] = "_NET_WM_STATE_FULLSCREEN",
+	[NetActiveWindow] = "_NET_ACTIVE_WINDOW",
+	[NetWMWindowType] = "_NET_WM_WINDOW_TYPE",
+	[NetWMWindowTypeDialog] = "_NET_WM_WINDOW_TYPE_DIALOG",
+	[NetClientList] = "_NET_CLIENT_LIST",
+};
 static char stext[1024];
+static StatusBlock stblocks[32];     /* stext split at statussep */
+static int nstblocks;
+static StatusOp stops[sizeof stext]; /* scratch for compilestatus() */
+static int stlen, stw;
+static Series stseries[16];          /* graph data, see seriesappend() */
+static int nstseries;
+static StatusColor *stcolors[64];
 static int screen;
 static int sw, sh;           /* X display screen geometry width, height */
 static int bh, blw = 0;      /* bar geometry */
@@ -265,12 +436,29 @@ static void (*handler[LASTEvent]) (XEvent *) = {
 };
 static Atom wmatom[WMLast], netatom[NetLast];
 static int running = 1;
+static int batchgeom = 0;         /* resizeclient() only records, see refresh() */
+static unsigned int layoutreqs;   /* requests sent by the last layout pass */
+static SavedClient *saved;        /* state handed over by restart() */
+static int nsaved, savedsel = -1;
 static Cur *cursor[CurLast];
 static Clr **scheme;
 static Display *dpy;
 static Drw *drw;
 static Monitor *mons, *selmon;
 static Window root, wmcheckwin;
+#ifdef XCB
+static Prefetch *pf;
+static unsigned int npf;
+static Atom pfatoms[PfLast];
+#endif /* XCB */
+static int ipcfd = -1;
+static struct sockaddr_un ipcaddr;
+static IpcClient ipcclients[16];
+static int pubmon = -1;           /* focus state last sent over IPC */
+static Window pubsel;
+static char pubname[256];
+static WinEntry *wintab;
+static unsigned int wintabsz, wintabbits, wintablen;
 
 static int useargb = 0;
 static Visual *visual;
@@ -284,21 +472,57 @@ static Colormap cmap;
 struct NumTags { char limitexceeded[LENGTH(tags) > 31 ? -1 : 1]; };
 
 /* function implementations */
+/* Send whatever part of the client's geometry changed since it was last
+ * applied; hidden clients are parked left of the screen. */
+void
+applygeom(Client *c)
+{
+	XWindowChanges wc;
+	unsigned int mask = 0;
+
+	wc.x = ISVISIBLE(c) ? c->x : WIDTH(c) * -2;
+	wc.y = c->y;
+	wc.width = c->w;
+	wc.height = c->h;
+	wc.border_width = c->bw;
+	if (wc.x != c->ax)
+		mask |= CWX;
+	if (wc.y != c->ay)
+		mask |= CWY;
+	if (wc.width != c->aw)
+		mask |= CWWidth;
+	if (wc.height != c->ah)
+		mask |= CWHeight;
+	if (wc.border_width != c->abw)
+		mask |= CWBorderWidth;
+	if (mask) {
+		XConfigureWindow(dpy, c->win, mask, &wc);
+		c->ax = wc.x;
+		c->ay = wc.y;
+		c->aw = wc.width;
+		c->ah = wc.height;
+		c->abw = wc.border_width;
+		layoutreqs++;
+	}
+	if (c->resized) {
+		configure(c);
+		c->resized = 0;
+		layoutreqs++;
+	}
+}
+
 void
 applyrules(Client *c)
 {
-	const char *class, *instance;
+	char class[256], instance[256];
 	unsigned int i;
 	const Rule *r;
 	Monitor *m;
-	XClassHint ch = { NULL, NULL };
 
 	/* rule matching */
 	c->isfloating = 0;
 	c->tags = 0;
-	XGetClassHint(dpy, c->win, &ch);
-	class    = ch.res_class ? ch.res_class : broken;
-	instance = ch.res_name  ? ch.res_name  : broken;
+	getclass(c->win, instance, class, sizeof class);
 
 	for (i = 0; i < LENGTH(rules); i++) {
 		r = &rules[i];
@@ -313,10 +537,6 @@ applyrules(Client *c)
 				c->mon = m;
 		}
 	}
-	if (ch.res_class)
-		XFree(ch.res_class);
-	if (ch.res_name)
-		XFree(ch.res_name);
 	c->tags = c->tags & TAGMASK ? c->tags & TAGMASK : c->mon->tagset[c->mon->seltags];
 }
 
@@ -390,14 +610,9 @@ void
 arrange(Monitor *m)
 {
 	if (m)
-		showhide(m->stack);
+		m->dirty |= DirtyLayout|DirtyStack|DirtyBar;
 	else for (m = mons; m; m = m->next)
-		showhide(m->stack);
-	if (m) {
-		arrangemon(m);
-		restack(m);
-	} else for (m = mons; m; m = m->next)
-		arrangemon(m);
+		m->dirty |= DirtyLayout;
 }
 
 void
@@ -448,7 +663,7 @@ buttonpress(XEvent *e)
 			arg.ui = 1 << i;
 		} else if (ev->x < x + blw)
 			click = ClkLtSymbol;
-		else if (ev->x > selmon->ww - TEXTW(stext))
+		else if (ev->x > selmon->ww - stw)
 			click = ClkStatusText;
 		else
 			click = ClkWinTitle;
@@ -481,9 +696,11 @@ cleanup(void)
 	Arg a = {.ui = ~0};
 	Layout foo = { "", NULL };
 	Monitor *m;
+	StatusColor *sc;
 	size_t i;
 
 	view(&a);
+	refresh();
 	selmon->lt[selmon->sellt] = &foo;
 	for (m = mons; m; m = m->next)
 		while (m->stack)
@@ -495,7 +712,25 @@ cleanup(void)
 		drw_cur_free(drw, cursor[i]);
 	for (i = 0; i < LENGTH(colors) + 1; i++)
 		free(scheme[i]);
+	for (i = 0; i < LENGTH(stcolors); i++)
+		while ((sc = stcolors[i])) {
+			stcolors[i] = sc->next;
+			XftColorFree(dpy, visual, cmap, &sc->clr);
+			free(sc);
+		}
+	for (i = 0; i < LENGTH(stblocks); i++) {
+		free(stblocks[i].text);
+		free(stblocks[i].buf);
+		free(stblocks[i].ops);
+		if (stblocks[i].pix)
+			XFreePixmap(dpy, stblocks[i].pix);
+	}
+	for (i = 0; i < LENGTH(stseries); i++)
+		if (stseries[i].pix)
+			XFreePixmap(dpy, stseries[i].pix);
 	XDestroyWindow(dpy, wmcheckwin);
+	ipccleanup();
+	free(wintab);
 	drw_free(drw);
 	XSync(dpy, False);
 	XSetInputFocus(dpy, PointerRoot, RevertToPointerRoot, CurrentTime);
@@ -514,6 +749,7 @@ cleanupmon(Monitor *mon)
 		m->next = mon->next;
 	}
 	XUnmapWindow(dpy, mon->barwin);
+	winmapdel(mon->barwin);
 	XDestroyWindow(dpy, mon->barwin);
 	free(mon);
 }
@@ -537,6 +773,119 @@ clientmessage(XEvent *e)
 	}
 }
 
+/* Parse the status2d codes of a block once into a list of draw ops with
+ * resolved colours and measured offsets, replayed by renderblock(). */
+void
+compilestatus(StatusBlock *b)
+{
+	char *s, *e, *text, c, code, buf[8], name[16];
+	int v[4], x = 0, valw, valh;
+	StatusOp *op;
+
+	stlen = 0;
+	strcpy(b->buf, b->text);
+	for (text = b->buf;; text = s + 1) {
+		for (s = text; *s && *s != '^'; s++);
+		c = *s;
+		*s = '\0';
+		if (*text && (op = statusop(StText))) {
+			op->x = x;
+			op->w = TEXTW(text) - lrpad;
+			op->text = text;
+			x += op->w;
+		}
+		if (!c)
+			break;
+
+		/* a code runs up to the next '^' */
+		for (s++; *s && *s != '^'; s++) {
+			memset(v, 0, sizeof v);
+			switch (*s) {
+			case 'c':
+			case 'b':
+				snprintf(buf, sizeof buf, "%.7s", s + 1);
+				if ((op = statusop(*s == 'c' ? StFg : StBg)))
+					op->clr = statuscolor(buf);
+				s += strlen(buf);
+				break;
+			case 'd':
+				statusop(StReset);
+				break;
+			case 'G':
+				for (e = s + 1; *e && *e != ',' && *e != '^'; e++);
+				snprintf(name, sizeof name, "%.*s", (int)(e - s - 1), s + 1);
+				s = *e == ',' ? statusargs(e, v, 2) : e - 1;
+				if ((op = statusop(StGraph))) {
+					op->series = seriesget(name, 0);
+					op->x = x;
+					op->y = 1;
+					op->w = MIN(MAX(v[0], 0), (int)LENGTH(op->series->v));
+					op->h = bh - 2;
+					op->max = v[1];
+				}
+				break;
+			case 'r':
+				s = statusargs(s, v, 4);
+				if ((op = statusop(StRect))) {
+					op->x = x + v[0];
+					op->y = v[1];
+					op->w = v[2];
+					op->h = v[3];
+				}
+				break;
+			case 'f':
+				s = statusargs(s, v, 1);
+				x += v[0];
+				break;
+			case 'h':
+			case 'v':
+			case 'V':
+				code = *s;
+				if (code == 'V') {
+					s = statusargs(s, v, 3);
+					valh = v[1] > 0 ? (float)v[2] / v[1] * (bh - 2) : 0;
+				} else {
+					s = statusargs(s, v, 2);
+					valh = (float)v[1] / 100 * (bh - 2);
+				}
+				valw = (float)v[1] / 100 * v[0];
+				if ((op = statusop(StRect))) {
+					op->x = x;
+					op->y = 1;
+					op->w = v[0];
+					op->h = bh - 2;
+					op->invert = 1;
+				}
+				if ((op = statusop(StRect))) {
+					op->x = x;
+					if (code == 'h') {
+						op->y = 1;
+						op->w = valw;
+						op->h = bh - 2;
+					} else {
+						op->y = bh - 2 - valh;
+						op->w = v[0];
+						op->h = valh;
+					}
+				}
+				break;
+			}
+			if (!*s)
+				break;
+		}
+		if (!*s)
+			break;
+	}
+	free(b->ops);
+	b->ops = NULL;
+	if ((b->nops = stlen)) {
+		b->ops = ecalloc(stlen, sizeof(StatusOp));
+		memcpy(b->ops, stops, stlen * sizeof(StatusOp));
+	}
+	b->w = MAX(x, 0);
+	b->stale = 1;
+}
+
 void
 configure(Client *c)
 {
@@ -619,8 +968,13 @@ configurerequest(XEvent *e)
 				c->y = m->my + (m->mh / 2 - HEIGHT(c) / 2); /* center in y direction */
 			if ((ev->value_mask & (CWX|CWY)) && !(ev->value_mask & (CWWidth|CWHeight)))
 				configure(c);
-			if (ISVISIBLE(c))
+			if (ISVISIBLE(c)) {
 				XMoveResizeWindow(dpy, c->win, c->x, c->y, c->w, c->h);
+				c->ax = c->x;
+				c->ay = c->y;
+				c->aw = c->w;
+				c->ah = c->h;
+			}
 		} else
 			configure(c);
 	} else {
@@ -701,189 +1055,99 @@ dirtomon(int dir)
 	return m;
 }
 
-int
-drawstatusbar(Monitor *m, int bh, char* stext) {
-	int ret, i, w, x, len;
-	short isCode = 0;
-	char *text;
-	char *p;
-
-	len = strlen(stext) + 1 ;
-	if (!(text = (char*) malloc(sizeof(char)*len)))
-		die("malloc");
-	p = text;
-	memcpy(text, stext, len);
-
-	/* compute width of the status text */
-	w = 0;
-	i = -1;
-	while (text[++i]) {
-		if (text[i] == '^') {
-			if (!isCode) {
-				isCode = 1;
-				text[i] = '\0';
-				w += TEXTW(text) - lrpad;
-				text[i] = '^';
-				if (text[++i] == 'f')
-					w += atoi(text + ++i);
-			} else {
-				isCode = 0;
-				text = text + i + 1;
-				i = -1;
+/* Sparkline of the newest op->w values, newest on the right. The series
+ * keeps the columns in a pixmap, one new value only shifts it by one. */
+void
+drawgraph(StatusOp *op, int x)
+{
+	Series *sr = op->series;
+	XRectangle r[LENGTH(sr->v)];
+	unsigned long fg = drw->scheme[ColFg].pixel, bg = drw->scheme[ColBg].pixel;
+	int i, n, v, max = op->max, w = op->w, h = op->h;
+
+	if (!sr || w <= 0 || h <= 0)
+		return;
+	if (max <= 0)
+		for (max = 1, i = 0; i < w; i++)
+			max = MAX(max, seriesval(sr, i));
+	if (!sr->pix || sr->pw != w || sr->ph != h || sr->pmax != max
+	|| sr->pfg != fg || sr->pbg != bg || sr->n - sr->pn > 1) {
+		if (sr->pix && (sr->pw != w || sr->ph != h)) {
+			XFreePixmap(dpy, sr->pix);
+			sr->pix = None;
+		}
+		if (!sr->pix)
+			sr->pix = XCreatePixmap(dpy, root, w, h, depth);
+		XSetForeground(dpy, drw->gc, bg);
+		XFillRectangle(dpy, sr->pix, drw->gc, 0, 0, w, h);
+		for (n = i = 0; i < w; i++) {
+			v = MIN(h, (int)((double)MAX(seriesval(sr, i), 0) * h / max));
+			if (v > 0) {
+				r[n].x = w - 1 - i;
+				r[n].y = h - v;
+				r[n].width = 1;
+				r[n++].height = v;
 			}
 		}
+		XSetForeground(dpy, drw->gc, fg);
+		XFillRectangles(dpy, sr->pix, drw->gc, r, n);
+	} else if (sr->n != sr->pn) {
+		XCopyArea(dpy, sr->pix, sr->pix, drw->gc, 1, 0, w - 1, h, 0, 0);
+		XSetForeground(dpy, drw->gc, bg);
+		XFillRectangle(dpy, sr->pix, drw->gc, w - 1, 0, 1, h);
+		v = MIN(h, (int)((double)MAX(seriesval(sr, 0), 0) * h / max));
+		XSetForeground(dpy, drw->gc, fg);
+		if (v > 0)
+			XFillRectangle(dpy, sr->pix, drw->gc, w - 1, h - v, 1, v);
 	}
-	if (!isCode)
-		w += TEXTW(text) - lrpad;
-	else
-		isCode = 0;
-	text = p;
-
-	w += 2; /* 1px padding on both sides */
-	ret = x = m->ww - w;
-
-	drw_setscheme(drw, scheme[LENGTH(colors)]);
-	drw->scheme[ColFg] = scheme[SchemeNorm][ColFg];
-	drw->scheme[ColBg] = scheme[SchemeNorm][ColBg];
-	drw_rect(drw, x, 0, w, bh, 1, 1);
-	x++;
-
-	/* process status text */
-	i = -1;
-	while (text[++i]) {
-		if (text[i] == '^' && !isCode) {
-			isCode = 1;
-
-			text[i] = '\0';
-			w = TEXTW(text) - lrpad;
-			drw_text(drw, x, 0, w, bh, 0, text, 0);
-
-			x += w;
-
-			/* process code */
-			while (text[++i] != '^') {
-				if (text[i] == 'c') {
-					char buf[8];
-					memcpy(buf, (char*)text+i+1, 7);
-					buf[7] = '\0';
-					drw_clr_create(drw, &drw->scheme[ColFg], buf, alpha_scheme[ColFg]);
-					i += 7;
-				} else if (text[i] == 'b') {
-					char buf[8];
-					memcpy(buf, (char*)text+i+1, 7);
-					buf[7] = '\0';
-					drw_clr_create(drw, &drw->scheme[ColBg], buf, alpha_scheme[ColFg]);
-					i += 7;
-				} else if (text[i] == 'd') {
-					drw->scheme[ColFg] = scheme[SchemeNorm][ColFg];
-					drw->scheme[ColBg] = scheme[SchemeNorm][ColBg];
-				} else if (text[i] == 'r') {
-					int rx = atoi(text + ++i);
-					while (text[++i] != ',');
-					int ry = atoi(text + ++i);
-					while (text[++i] != ',');
-					int rw = atoi(text + ++i);
-					while (text[++i] != ',');
-					int rh = atoi(text + ++i);
-
-					drw_rect(drw, rx + x, ry, rw, rh, 1, 0);
-				} else if (text[i] == 'f') {
-					x += atoi(text + ++i);
-				} else if (text[i] == 'h') {
-					int barw = atoi(text + ++i);
-					while (text[++i] != ',');
-					int val = atoi(text + ++i);
-
-					drw_rect(drw, x, 1, barw, bh - 2, 1, 1);
-
-					int valw = (float)val / 100 * barw;
-					drw_rect(drw, x, 1, valw, bh - 2, 1, 0);
-				} else if (text[i] == 'v') {
-					int barw = atoi(text + ++i);
-					while (text[++i] != ',');
-					int val = atoi(text + ++i);
-
-					drw_rect(drw, x, 1, barw, bh - 2, 1, 1);
-
-					int valh = (float)val / 100 * (bh - 2);
-					drw_rect(drw, x, bh - 2 - valh, barw, valh, 1, 0);
-				} else if (text[i] == 'V') {
-					int barw = atoi(text + ++i);
-					while (text[++i] != ',');
-					int max = atoi(text + ++i);
-					while (text[++i] != ',');
-					int val = atoi(text + ++i);
-
-					drw_rect(drw, x, 1, barw, bh - 2, 1, 1);
-
-					int valh = (float)val / max * (bh - 2);
-					drw_rect(drw, x, bh - 2 - valh, barw, valh, 1, 0);
-				}
-			}
+	sr->pw = w;
+	sr->ph = h;
+	sr->pmax = max;
+	sr->pfg = fg;
+	sr->pbg = bg;
+	sr->pn = sr->n;
+	XCopyArea(dpy, sr->pix, drw->drawable, drw->gc, 0, 0, w, h, x, op->y);
+}
 
-			text = text + i + 1;
-			i=-1;
-			isCode = 0;
+/* Blocks keep their last rendering in a pixmap: a full bar redraw copies
+ * them back, a partial one only renders and maps the blocks that changed. */
+int
+drawstatusbar(Monitor *m, int partial)
+{
+	int i, x, bx;
+	StatusBlock *b;
+
+	x = m->ww - stw;
+	if (partial) {
+		/* blocks did not move, but must not cover tags or layout */
+		for (bx = i = 0; i < LENGTH(tags); i++)
+			bx += TEXTW(tags[i]);
+		if (x < bx + TEXTW(m->ltsymbol)) {
+			renderbar(m);
+			return x;
 		}
+	} else {
+		drw_setscheme(drw, scheme[SchemeNorm]);
+		drw_rect(drw, x, 0, stw, bh, 1, 1);
 	}
-
-	if (!isCode) {
-		w = TEXTW(text) - lrpad;
-		drw_text(drw, x, 0, w, bh, 0, text, 0);
+	for (i = 0, bx = x + 1; i < nstblocks; bx += b->w, i++) {
+		b = &stblocks[i];
+		if (b->stale)
+			renderblock(b, bx);
+		else if (!partial && b->pix)
+			XCopyArea(dpy, b->pix, drw->drawable, drw->gc, 0, 0, b->w, bh, bx, 0);
+		else
+			continue;
+		if (partial && b->w)
+			drw_map(drw, m->barwin, bx, 0, b->w, bh);
 	}
-
-	drw_setscheme(drw, scheme[SchemeNorm]);
-	free(p);
-
-	return ret;
+	return x;
 }
 
 void
 drawbar(Monitor *m)
 {
-	int x, w, sw = 0;
-	int boxs = drw->fonts->h / 9;
-	int boxw = drw->fonts->h / 6 + 2;
-	unsigned int i, occ = 0, urg = 0;
-	Client *c;
-
-	/* draw status first so it can be overdrawn by tags later */
-	if (m == selmon) { /* status is only drawn on selected monitor */
-		sw = m->ww - drawstatusbar(m, bh, stext);
-	}
-
-	for (c = m->clients; c; c = c->next) {
-		occ |= c->tags;
-		if (c->isurgent)
-			urg |= c->tags;
-	}
-	x = 0;
-	for (i = 0; i < LENGTH(tags); i++) {
-		w = TEXTW(tags[i]);
-		drw_setscheme(drw, scheme[m->tagset[m->seltags] & 1 << i ? SchemeSel : SchemeNorm]);
-		drw_text(drw, x, 0, w, bh, lrpad / 2, tags[i], urg & 1 << i);
-		if (occ & 1 << i)
-			drw_rect(drw, x + boxs, boxs, boxw, boxw,
-				m == selmon && selmon->sel && selmon->sel->tags & 1 << i,
-				urg & 1 << i);
-		x += w;
-	}
-	w = blw = TEXTW(m->ltsymbol);
-	drw_setscheme(drw, scheme[SchemeNorm]);
-	x = drw_text(drw, x, 0, w, bh, lrpad / 2, m->ltsymbol, 0);
-
-	if ((w = m->ww - sw - x) > bh) {
-		if (m->sel) {
-			drw_setscheme(drw, scheme[m == selmon ? SchemeSel : SchemeNorm]);
-			drw_text(drw, x, 0, w, bh, lrpad / 2, m->sel->name, 0);
-			if (m->sel->isfloating)
-				drw_rect(drw, x + boxs, boxs, boxw, boxw, m->sel->isfixed, 0);
-		} else {
-			drw_setscheme(drw, scheme[SchemeNorm]);
-			drw_rect(drw, x, 0, w, bh, 1, 1);
-		}
-	}
-	drw_map(drw, m->barwin, 0, 0, m->ww, bh);
+	m->dirty |= DirtyBar;
 }
 
 void
@@ -1006,6 +1270,13 @@ getatomprop(Client *c, Atom prop)
 	unsigned long dl;
 	unsigned char *p = NULL;
 	Atom da, atom = None;
+#ifdef XCB
+	xcb_get_property_reply_t *r;
+
+	if (prefetched(c->win, prop, &r))
+		return r && r->type == XA_ATOM && r->format == 32 && r->value_len
+		       ? *(uint32_t *)xcb_get_property_value(r) : None;
+#endif /* XCB */
 
 	if (XGetWindowProperty(dpy, c->win, prop, 0L, sizeof atom, False, XA_ATOM,
 		&da, &di, &dl, &dl, &p) == Success && p) {
@@ -1015,6 +1286,70 @@ getatomprop(Client *c, Atom prop)
 	return atom;
 }
 
+int
+getattrs(Window w, XWindowAttributes *wa)
+{
+#ifdef XCB
+	Prefetch *p;
+
+	if ((p = prefetchwin(w))) {
+		if (!p->attr || !p->geom)
+			return 0;
+		wa->x = p->geom->x;
+		wa->y = p->geom->y;
+		wa->width = p->geom->width;
+		wa->height = p->geom->height;
+		wa->border_width = p->geom->border_width;
+		wa->override_redirect = p->attr->override_redirect;
+		wa->map_state = p->attr->map_state;
+		return 1;
+	}
+#endif /* XCB */
+	return XGetWindowAttributes(dpy, w, wa);
+}
+
+/* WM_CLASS of w, each part "broken" if unset */
+void
+getclass(Window w, char *instance, char *class, unsigned int size)
+{
+	XClassHint ch = { NULL, NULL };
+#ifdef XCB
+	xcb_get_property_reply_t *r;
+	char *v, *e;
+	int len = 0, n;
+
+	if (prefetched(w, XA_WM_CLASS, &r)) {
+		/* "instance\0class\0" */
+		if (r && r->format == 8)
+			len = xcb_get_property_value_length(r);
+		if (len <= 0) {
+			snprintf(instance, size, "%s", broken);
+			snprintf(class, size, "%s", broken);
+			return;
+		}
+		v = xcb_get_property_value(r);
+		n = (e = memchr(v, '\0', len)) ? e - v : len;
+		snprintf(instance, size, "%.*s", n, v);
+		if (n + 1 < len) {
+			v += n + 1;
+			len -= n + 1;
+			n = (e = memchr(v, '\0', len)) ? e - v : len;
+			snprintf(class, size, "%.*s", n, v);
+		} else
+			snprintf(class, size, "%s", broken);
+		return;
+	}
+#endif /* XCB */
+
+	XGetClassHint(dpy, w, &ch);
+	snprintf(instance, size, "%s", ch.res_name ? ch.res_name : broken);
+	snprintf(class, size, "%s", ch.res_class ? ch.res_class : broken);
+	if (ch.res_class)
+		XFree(ch.res_class);
+	if (ch.res_name)
+		XFree(ch.res_name);
+}
+
 char *
 getdwmpath()
 {
@@ -1056,6 +1391,76 @@ getdwmpath()
 }
 
 
+/* WM_HINTS of w, to be freed with XFree() */
+XWMHints *
+gethints(Window w)
+{
+#ifdef XCB
+	xcb_get_property_reply_t *r;
+	XWMHints *wmh;
+	int32_t *v;
+
+	if (prefetched(w, XA_WM_HINTS, &r)) {
+		/* the window_group field was added later, accept hints without it */
+		if (!r || r->type != XA_WM_HINTS || r->format != 32 || r->value_len < 8)
+			return NULL;
+		v = xcb_get_property_value(r);
+		if (!(wmh = XAllocWMHints()))
+			return NULL;
+		wmh->flags = v[0];
+		wmh->input = v[1];
+		wmh->initial_state = v[2];
+		wmh->icon_pixmap = (uint32_t)v[3];
+		wmh->icon_window = (uint32_t)v[4];
+		wmh->icon_x = v[5];
+		wmh->icon_y = v[6];
+		wmh->icon_mask = (uint32_t)v[7];
+		if (r->value_len > 8)
+			wmh->window_group = (uint32_t)v[8];
+		else
+			wmh->flags &= ~WindowGroupHint;
+		return wmh;
+	}
+#endif /* XCB */
+	return XGetWMHints(dpy, w);
+}
+
+int
+getnormalhints(Window w, XSizeHints *size)
+{
+	long msize;
+#ifdef XCB
+	xcb_get_property_reply_t *r;
+	int32_t *v;
+
+	if (prefetched(w, XA_WM_NORMAL_HINTS, &r)) {
+		/* ICCCM 1 hints lack base size and gravity */
+		if (!r || r->type != XA_WM_SIZE_HINTS || r->format != 32 || r->value_len < 15)
+			return 0;
+		v = xcb_get_property_value(r);
+		size->flags = v[0];
+		size->min_width = v[5];
+		size->min_height = v[6];
+		size->max_width = v[7];
+		size->max_height = v[8];
+		size->width_inc = v[9];
+		size->height_inc = v[10];
+		size->min_aspect.x = v[11];
+		size->min_aspect.y = v[12];
+		size->max_aspect.x = v[13];
+		size->max_aspect.y = v[14];
+		if (r->value_len >= 18) {
+			size->base_width = v[15];
+			size->base_height = v[16];
+			size->win_gravity = v[17];
+		} else
+			size->flags &= ~(PBaseSize|PWinGravity);
+		return 1;
+	}
+#endif /* XCB */
+	return XGetWMNormalHints(dpy, w, size, &msize);
+}
+
 int
 getrootptr(int *x, int *y)
 {
@@ -1074,6 +1479,13 @@ getstate(Window w)
 	unsigned char *p = NULL;
 	unsigned long n, extra;
 	Atom real;
+#ifdef XCB
+	xcb_get_property_reply_t *r;
+
+	if (prefetched(w, wmatom[WMState], &r))
+		return r && r->type == wmatom[WMState] && r->format == 32 && r->value_len
+		       ? *(uint32_t *)xcb_get_property_value(r) : -1;
+#endif /* XCB */
 
 	if (XGetWindowProperty(dpy, w, wmatom[WMState], 0L, 2L, False, wmatom[WMState],
 		&real, &format, &n, &extra, (unsigned char **)&p) != Success)
@@ -1088,12 +1500,28 @@ int
 gettextprop(Window w, Atom atom, char *text, unsigned int size)
 {
 	char **list = NULL;
-	int n;
+	int n, xlib = 1;
 	XTextProperty name;
+#ifdef XCB
+	xcb_get_property_reply_t *r;
+#endif /* XCB */
 
 	if (!text || size == 0)
 		return 0;
 	text[0] = '\0';
+#ifdef XCB
+	if (prefetched(w, atom, &r)) {
+		if (!r || r->format != 8 || !(n = xcb_get_property_value_length(r)))
+			return 0;
+		/* XGetTextProperty hands out a terminated copy, so do we */
+		name.value = ecalloc(n + 1, 1);
+		memcpy(name.value, xcb_get_property_value(r), n);
+		name.encoding = r->type;
+		name.format = 8;
+		name.nitems = n;
+		xlib = 0;
+	} else
+#endif /* XCB */
 	if (!XGetTextProperty(dpy, w, &name, atom) || !name.nitems)
 		return 0;
 	if (name.encoding == XA_STRING)
@@ -1105,10 +1533,29 @@ gettextprop(Window w, Atom atom, char *text, unsigned int size)
 		}
 	}
 	text[size - 1] = '\0';
-	XFree(name.value);
+	if (xlib)
+		XFree(name.value);
+	else
+		free(name.value);
 	return 1;
 }
 
+int
+gettransient(Window w, Window *trans)
+{
+#ifdef XCB
+	xcb_get_property_reply_t *r;
+
+	if (prefetched(w, XA_WM_TRANSIENT_FOR, &r)) {
+		if (!r || r->type != XA_WINDOW || r->format != 32 || !r->value_len)
+			return 0;
+		*trans = *(uint32_t *)xcb_get_property_value(r);
+		return 1;
+	}
+#endif /* XCB */
+	return XGetTransientForHint(dpy, w, trans);
+}
+
 void
 grabbuttons(Client *c, int focused)
 {
@@ -1155,84 +1602,564 @@ incnmaster(const Arg *arg)
 	arrange(selmon);
 }
 
-#ifdef XINERAMA
-static int
-isuniquegeom(XineramaScreenInfo *unique, size_t n, XineramaScreenInfo *info)
+void
+ipccleanup(void)
 {
-	while (n--)
-		if (unique[n].x_org == info->x_org && unique[n].y_org == info->y_org
-		&& unique[n].width == info->width && unique[n].height == info->height)
-			return 0;
-	return 1;
+	size_t i;
+
+	for (i = 0; i < LENGTH(ipcclients); i++)
+		if (ipcclients[i].fd != -1)
+			ipcclose(&ipcclients[i]);
+	if (ipcfd != -1) {
+		close(ipcfd);
+		unlink(ipcaddr.sun_path);
+		ipcfd = -1;
+	}
 }
-#endif /* XINERAMA */
 
 void
-keypress(XEvent *e)
+ipcclose(IpcClient *cl)
 {
-	unsigned int i;
-	KeySym keysym;
-	XKeyEvent *ev;
-
-	ev = &e->xkey;
-	keysym = XKeycodeToKeysym(dpy, (KeyCode)ev->keycode, 0);
-	for (i = 0; i < LENGTH(keys); i++)
-		if (keysym == keys[i].keysym
-		&& CLEANMASK(keys[i].mod) == CLEANMASK(ev->state)
-		&& keys[i].func)
-			keys[i].func(&(keys[i].arg));
+	close(cl->fd);
+	cl->fd = -1;
+	cl->len = 0;
+	cl->subs = 0;
 }
 
 void
-killclient(const Arg *arg)
+ipcevent(IpcClient *to, unsigned int ev, const char *fmt, ...)
 {
-	if (!selmon->sel)
+	char buf[512];
+	va_list ap;
+	size_t i, n;
+
+	va_start(ap, fmt);
+	n = ipcline(buf, sizeof buf, fmt, ap);
+	va_end(ap);
+	if (to) {
+		if (to->subs & ev)
+			ipcwrite(to, buf, n);
 		return;
-	if (!sendevent(selmon->sel, wmatom[WMDelete])) {
-		XGrabServer(dpy);
-		XSetErrorHandler(xerrordummy);
-		XSetCloseDownMode(dpy, DestroyAll);
-		XKillClient(dpy, selmon->sel->win);
-		XSync(dpy, False);
-		XSetErrorHandler(xerror);
-		XUngrabServer(dpy);
 	}
+	for (i = 0; i < LENGTH(ipcclients); i++)
+		if (ipcclients[i].fd != -1 && (ipcclients[i].subs & ev))
+			ipcwrite(&ipcclients[i], buf, n);
 }
 
-void
-manage(Window w, XWindowAttributes *wa)
+int
+ipcfds(fd_set *fds, int maxfd)
 {
-	Client *c, *t = NULL;
-	Window trans = None;
-	XWindowChanges wc;
+	size_t i;
 
-	c = ecalloc(1, sizeof(Client));
-	c->win = w;
-	/* geometry */
-	c->x = c->oldx = wa->x;
-	c->y = c->oldy = wa->y;
-	c->w = c->oldw = wa->width;
-	c->h = c->oldh = wa->height;
-	c->oldbw = wa->border_width;
+	if (ipcfd == -1)
+		return maxfd;
+	FD_SET(ipcfd, fds);
+	maxfd = MAX(maxfd, ipcfd);
+	for (i = 0; i < LENGTH(ipcclients); i++)
+		if (ipcclients[i].fd != -1) {
+			FD_SET(ipcclients[i].fd, fds);
+			maxfd = MAX(maxfd, ipcclients[i].fd);
+		}
+	return maxfd;
+}
 
-	updatetitle(c);
-	if (XGetTransientForHint(dpy, w, &trans) && (t = wintoclient(trans))) {
-		c->mon = t->mon;
-		c->tags = t->tags;
-	} else {
-		c->mon = selmon;
-		applyrules(c);
+void
+ipchandle(fd_set *fds)
+{
+	IpcClient *cl;
+	char *nl;
+	size_t i, n;
+	ssize_t r;
+	int fd;
+
+	if (ipcfd == -1)
+		return;
+	if (FD_ISSET(ipcfd, fds))
+		while ((fd = accept(ipcfd, NULL, NULL)) != -1) {
+			for (i = 0; i < LENGTH(ipcclients) && ipcclients[i].fd != -1; i++);
+			if (i == LENGTH(ipcclients) || fd >= FD_SETSIZE) {
+				close(fd);
+				continue;
+			}
+			fcntl(fd, F_SETFD, FD_CLOEXEC);
+			fcntl(fd, F_SETFL, O_NONBLOCK);
+			ipcclients[i].fd = fd;
+		}
+	for (i = 0; i < LENGTH(ipcclients); i++) {
+		cl = &ipcclients[i];
+		if (cl->fd == -1 || !FD_ISSET(cl->fd, fds))
+			continue;
+		r = read(cl->fd, cl->buf + cl->len, sizeof cl->buf - cl->len);
+		if (r == 0 || (r == -1 && errno != EAGAIN && errno != EINTR)) {
+			ipcclose(cl);
+			continue;
+		}
+		if (r > 0)
+			cl->len += r;
+		while (cl->fd != -1 && (nl = memchr(cl->buf, '\n', cl->len))) {
+			*nl = '\0';
+			n = nl - cl->buf + 1;
+			ipcrequest(cl, cl->buf);
+			if (cl->fd == -1)
+				break;
+			memmove(cl->buf, cl->buf + n, cl->len - n);
+			cl->len -= n;
+		}
+		if (cl->fd != -1 && cl->len == sizeof cl->buf) {
+			ipcsend(cl, "error request too long");
+			ipcclose(cl);
+		}
 	}
+}
 
-	if (c->x + WIDTH(c) > c->mon->mx + c->mon->mw)
-		c->x = c->mon->mx + c->mon->mw - WIDTH(c);
-	if (c->y + HEIGHT(c) > c->mon->my + c->mon->mh)
-		c->y = c->mon->my + c->mon->mh - HEIGHT(c);
-	c->x = MAX(c->x, c->mon->mx);
+/* The socket goes into a directory only we can enter, XDG_RUNTIME_DIR
+ * or /tmp/dwm-<uid>, and is named after the display we manage. */
+void
+ipcinit(void)
+{
+	char dir[256], disp[64], *env;
+	struct stat st;
+	mode_t mask;
+	size_t i;
+	int n;
+
+	for (i = 0; i < LENGTH(ipcclients); i++)
+		ipcclients[i].fd = -1;
+	if (!ipcsocket)
+		return;
+	env = DisplayString(dpy);
+	for (i = 0; env[i] && i < sizeof disp - 1; i++)
+		disp[i] = isalnum((unsigned char)env[i]) || env[i] == '.' || env[i] == ':'
+			? env[i] : '_';
+	disp[i] = '\0';
+	if ((env = getenv("XDG_RUNTIME_DIR")))
+		n = snprintf(dir, sizeof dir, "%s", env);
+	else if ((n = snprintf(dir, sizeof dir, "/tmp/dwm-%d", (int)getuid())) > 0)
+		mkdir(dir, 0700);
+	if (n < 0 || (size_t)n >= sizeof dir || lstat(dir, &st) == -1 || !S_ISDIR(st.st_mode)
+	|| st.st_uid != getuid() || (st.st_mode & 077)) {
+		fprintf(stderr, "dwm: no private directory for the IPC socket\n");
+		return;
+	}
+	ipcaddr.sun_family = AF_UNIX;
+	n = snprintf(ipcaddr.sun_path, sizeof ipcaddr.sun_path, "%s/dwm-%d-%s.sock",
+		dir, (int)getuid(), disp);
+	if (n < 0 || (size_t)n >= sizeof ipcaddr.sun_path) {
+		fprintf(stderr, "dwm: IPC socket path too long\n");
+		return;
+	}
+	if ((ipcfd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+		die("socket:");
+	/* a stale socket from a crashed or restarted dwm */
+	unlink(ipcaddr.sun_path);
+	mask = umask(077);
+	n = bind(ipcfd, (struct sockaddr *)&ipcaddr, sizeof ipcaddr);
+	umask(mask);
+	if (n == -1 || listen(ipcfd, LENGTH(ipcclients)) == -1) {
+		fprintf(stderr, "dwm: cannot listen on %s: %s\n", ipcaddr.sun_path, strerror(errno));
+		close(ipcfd);
+		ipcfd = -1;
+		return;
+	}
+	fcntl(ipcfd, F_SETFD, FD_CLOEXEC);
+	fcntl(ipcfd, F_SETFL, O_NONBLOCK);
+	setenv("DWM_SOCKET", ipcaddr.sun_path, 1);
+}
+
+/* Format one protocol line. Window titles and status text may contain
+ * anything, control characters would break the line framing. */
+size_t
+ipcline(char *buf, size_t size, const char *fmt, va_list ap)
+{
+	size_t i, n;
+	int r;
+
+	if ((r = vsnprintf(buf, size - 1, fmt, ap)) < 0)
+		r = 0;
+	n = MIN((size_t)r, size - 2);
+	for (i = 0; i < n; i++)
+		if ((unsigned char)buf[i] < ' ' || buf[i] == 0x7f)
+			buf[i] = ' ';
+	buf[n++] = '\n';
+	return n;
+}
+
+/* Publish state to subscribers: to everyone what changed since the last
+ * call, or to a single new subscriber everything. */
+void
+ipcnotify(IpcClient *to)
+{
+	Monitor *m;
+	Client *c;
+	unsigned int occ, urg;
+	Window sel;
+
+	if (ipcfd == -1)
+		return;
+	for (m = mons; m; m = m->next) {
+		for (occ = urg = 0, c = m->clients; c; c = c->next) {
+			occ |= c->tags;
+			if (c->isurgent)
+				urg |= c->tags;
+		}
+		if (to || m->pubtags[0] != m->tagset[m->seltags]
+		|| m->pubtags[1] != occ || m->pubtags[2] != urg)
+			ipcevent(to, EvTags, "event tags %d %u %u %u",
+				m->num, m->tagset[m->seltags], occ, urg);
+		if (to || strcmp(m->publt, m->ltsymbol))
+			ipcevent(to, EvLayout, "event layout %d %s", m->num, m->ltsymbol);
+		if (!to) {
+			m->pubtags[0] = m->tagset[m->seltags];
+			m->pubtags[1] = occ;
+			m->pubtags[2] = urg;
+			strcpy(m->publt, m->ltsymbol);
+		}
+	}
+	if (to || pubmon != selmon->num)
+		ipcevent(to, EvMonitor, "event monitor %d", selmon->num);
+	sel = selmon->sel ? selmon->sel->win : None;
+	if (to || pubmon != selmon->num || pubsel != sel
+	|| strcmp(pubname, selmon->sel ? selmon->sel->name : ""))
+		ipcevent(to, EvFocus, "event focus %d 0x%lx %s", selmon->num, sel,
+			selmon->sel ? selmon->sel->name : "");
+	if (!to) {
+		pubmon = selmon->num;
+		pubsel = sel;
+		strcpy(pubname, selmon->sel ? selmon->sel->name : "");
+	}
+}
+
+void
+ipcquery(IpcClient *cl, const char *what)
+{
+	Monitor *m;
+	Client *c;
+	unsigned int i, occ = 0, urg = 0;
+
+	/* answer with what is on screen, not with pending work */
+	refresh();
+	if (!what) {
+		ipcsend(cl, "error missing argument");
+	} else if (!strcmp(what, "monitors")) {
+		for (m = mons; m; m = m->next)
+			ipcsend(cl, "monitor %d %d %d %d %d %d %u %s", m->num,
+				m == selmon, m->mx, m->my, m->mw, m->mh,
+				m->tagset[m->seltags], m->ltsymbol);
+		ipcsend(cl, "ok");
+	} else if (!strcmp(what, "clients")) {
+		for (m = mons; m; m = m->next)
+			for (c = m->clients; c; c = c->next)
+				ipcsend(cl, "client 0x%lx %d %u %d %d %d %d %d %d %d %d %s",
+					c->win, m->num, c->tags, c->isfloating,
+					c->isfullscreen, c->isurgent, c == selmon->sel,
+					c->x, c->y, c->w, c->h, c->name);
+		ipcsend(cl, "ok");
+	} else if (!strcmp(what, "tags")) {
+		for (c = selmon->clients; c; c = c->next) {
+			occ |= c->tags;
+			if (c->isurgent)
+				urg |= c->tags;
+		}
+		for (i = 0; i < LENGTH(tags); i++)
+			ipcsend(cl, "tag %u %d %d %d %s", 1 << i,
+				!!(selmon->tagset[selmon->seltags] & 1 << i),
+				!!(occ & 1 << i), !!(urg & 1 << i), tags[i]);
+		ipcsend(cl, "ok");
+	} else if (!strcmp(what, "blocks")) {
+		for (i = 0; i < nstblocks; i++)
+			ipcsend(cl, "block %u %d %s", i, stblocks[i].w, stblocks[i].text);
+		ipcsend(cl, "ok");
+	} else if (!strcmp(what, "layouts")) {
+		for (i = 0; i < LENGTH(layouts); i++)
+			ipcsend(cl, "layout %u %s", i, layouts[i].symbol);
+		ipcsend(cl, "ok");
+	} else {
+		ipcsend(cl, "error unknown query: %s", what);
+	}
+}
+
+void
+ipcrequest(IpcClient *cl, char *line)
+{
+	static const char *evnames[] = { "tags", "layout", "focus", "monitor" };
+	const IpcCommand *cmd = NULL;
+	char *verb, *s, *end;
+	unsigned int i, subs;
+	int moved;
+	Series *sr;
+	Arg a = {0};
+
+	if (!strncmp(line, "status ", 7)) {
+		/* the rest of the line is the block text, spaces included */
+		i = strtoul(line + 7, &end, 10);
+		if (end == line + 7 || (*end && *end++ != ' ') || i >= LENGTH(stblocks)) {
+			ipcsend(cl, "error bad block");
+			return;
+		}
+		ipcsend(cl, "ok");
+		statusappends(end);
+		moved = setblock(i, end);
+		for (; nstblocks < (int)i; nstblocks++)
+			moved |= setblock(nstblocks, "");
+		nstblocks = MAX(nstblocks, (int)i + 1);
+		statuschanged(moved);
+		return;
+	}
+	if (!(verb = strtok(line, " \t\r")))
+		return;
+	s = strtok(NULL, " \t\r");
+	if (!strcmp(verb, "get")) {
+		ipcquery(cl, s);
+		return;
+	} else if (!strcmp(verb, "subscribe")) {
+		for (subs = 0; s; s = strtok(NULL, " \t\r")) {
+			for (i = 0; i < LENGTH(evnames) && strcmp(s, evnames[i]); i++);
+			if (i == LENGTH(evnames)) {
+				ipcsend(cl, "error unknown event: %s", s);
+				return;
+			}
+			subs |= 1 << i;
+		}
+		/* settle pending work first so the snapshot is not repeated */
+		refresh();
+		cl->subs |= subs ? subs : EvAll;
+		ipcsend(cl, "ok");
+		ipcnotify(cl);
+		return;
+	} else if (!strcmp(verb, "unsubscribe")) {
+		cl->subs = 0;
+		ipcsend(cl, "ok");
+		return;
+	} else if (!strcmp(verb, "append")) {
+		if (!s || !(verb = strtok(NULL, " \t\r"))) {
+			ipcsend(cl, "error missing argument");
+			return;
+		}
+		errno = 0;
+		a.i = strtol(verb, &end, 0);
+		if (end == verb || *end || errno) {
+			ipcsend(cl, "error bad argument: %s", verb);
+		} else if (!(sr = seriesget(s, 1))) {
+			ipcsend(cl, "error too many series");
+		} else {
+			seriesappend(sr, a.i);
+			ipcsend(cl, "ok");
+		}
+		return;
+	}
+
+	for (i = 0; i < LENGTH(ipccommands); i++)
+		if (!strcmp(verb, ipccommands[i].name))
+			cmd = &ipccommands[i];
+	if (!cmd) {
+		ipcsend(cl, "error unknown command: %s", verb);
+		return;
+	}
+	if (s) {
+		errno = 0;
+		switch (cmd->arg) {
+		case IpcArgInt:    a.i = strtol(s, &end, 0); break;
+		case IpcArgUint:   a.ui = strtoul(s, &end, 0); break;
+		case IpcArgFloat:  a.f = strtof(s, &end); break;
+		case IpcArgLayout:
+			i = strtoul(s, &end, 0);
+			if (i < LENGTH(layouts))
+				a.v = &layouts[i];
+			else
+				errno = ERANGE;
+			break;
+		default: end = s; break;
+		}
+		if (end == s || *end || errno) {
+			ipcsend(cl, "error bad argument: %s", s);
+			return;
+		}
+	}
+	ipcsend(cl, "ok");
+	cmd->func(&a);
+}
+
+void
+ipcsend(IpcClient *cl, const char *fmt, ...)
+{
+	char buf[512];
+	va_list ap;
+	size_t n;
+
+	va_start(ap, fmt);
+	n = ipcline(buf, sizeof buf, fmt, ap);
+	va_end(ap);
+	ipcwrite(cl, buf, n);
+}
+
+/* Clients must keep up with what they asked for, a full socket buffer
+ * drops the connection rather than blocking the window manager. */
+void
+ipcwrite(IpcClient *cl, const char *buf, size_t len)
+{
+	if (cl->fd != -1 && send(cl->fd, buf, len, MSG_NOSIGNAL) != (ssize_t)len)
+		ipcclose(cl);
+}
+
+#ifdef XINERAMA
+static int
+isuniquegeom(XineramaScreenInfo *unique, size_t n, XineramaScreenInfo *info)
+{
+	while (n--)
+		if (unique[n].x_org == info->x_org && unique[n].y_org == info->y_org
+		&& unique[n].width == info->width && unique[n].height == info->height)
+			return 0;
+	return 1;
+}
+#endif /* XINERAMA */
+
+void
+keypress(XEvent *e)
+{
+	unsigned int i;
+	KeySym keysym;
+	XKeyEvent *ev;
+
+	ev = &e->xkey;
+	keysym = XKeycodeToKeysym(dpy, (KeyCode)ev->keycode, 0);
+	for (i = 0; i < LENGTH(keys); i++)
+		if (keysym == keys[i].keysym
+		&& CLEANMASK(keys[i].mod) == CLEANMASK(ev->state)
+		&& keys[i].func)
+			keys[i].func(&(keys[i].arg));
+}
+
+void
+killclient(const Arg *arg)
+{
+	if (!selmon->sel)
+		return;
+	if (!sendevent(selmon->sel, wmatom[WMDelete])) {
+		XGrabServer(dpy);
+		XSetErrorHandler(xerrordummy);
+		XSetCloseDownMode(dpy, DestroyAll);
+		XKillClient(dpy, selmon->sel->win);
+		XSync(dpy, False);
+		XSetErrorHandler(xerror);
+		XUngrabServer(dpy);
+	}
+}
+
+/* Pick up the state restart() left behind: monitor settings are applied
+ * right away, clients once scan() manages their windows. */
+void
+loadstate(void)
+{
+	Atom type;
+	int format, num, lt[2], n;
+	unsigned long items, extra;
+	unsigned char *p = NULL;
+	char *line;
+	Monitor *m;
+	SavedClient *sc;
+	unsigned int tagset[2], seltags, sellt;
+	float mfact;
+	int nmaster, showbar;
+
+	if (XGetWindowProperty(dpy, root, wmatom[WMDwmState], 0L, 65536L, True, XA_STRING,
+		&type, &format, &items, &extra, &p) != Success || !p)
+		return;
+	if (format != 8 || strncmp((char *)p, "dwm-state 1\n", 12)) {
+		XFree(p);
+		return;
+	}
+	for (n = 0, line = (char *)p; (line = strchr(line, '\n')); line++, n++);
+	saved = ecalloc(n, sizeof(SavedClient));
+
+	for (line = strtok((char *)p, "\n"); line; line = strtok(NULL, "\n")) {
+		switch (line[0]) {
+		case 's':
+			sscanf(line, "s %d", &savedsel);
+			break;
+		case 'm':
+			if (sscanf(line, "m %d %u %u %u %u %d %d %f %d %d", &num, &tagset[0],
+				&tagset[1], &seltags, &sellt, &lt[0], &lt[1], &mfact, &nmaster,
+				&showbar) != 10)
+				break;
+			for (m = mons; m && m->num != num; m = m->next);
+			if (!m || seltags > 1 || sellt > 1 || lt[0] < 0 || lt[1] < 0
+			|| lt[0] >= LENGTH(layouts) || lt[1] >= LENGTH(layouts))
+				break;
+			m->tagset[0] = tagset[0] & TAGMASK ? tagset[0] & TAGMASK : 1;
+			m->tagset[1] = tagset[1] & TAGMASK ? tagset[1] & TAGMASK : 1;
+			m->seltags = seltags;
+			m->sellt = sellt;
+			m->lt[0] = &layouts[lt[0]];
+			m->lt[1] = &layouts[lt[1]];
+			m->mfact = mfact;
+			m->nmaster = nmaster;
+			if (m->showbar != showbar) {
+				m->showbar = showbar;
+				updatebarpos(m);
+				XMoveResizeWindow(dpy, m->barwin, m->wx, m->by, m->ww, bh);
+			}
+			strncpy(m->ltsymbol, m->lt[m->sellt]->symbol, sizeof m->ltsymbol);
+			break;
+		case 'c':
+			sc = &saved[nsaved];
+			if (sscanf(line, "c %lu %d %u %d %d %d %d %d %d %d %d", &sc->win, &sc->mon,
+				&sc->tags, &sc->isfloating, &sc->x, &sc->y, &sc->w, &sc->h,
+				&sc->oldbw, &sc->order, &sc->stackorder) == 11)
+				nsaved++;
+			break;
+		}
+	}
+	XFree(p);
+}
+
+void
+manage(Window w, XWindowAttributes *wa)
+{
+	Client *c, *t = NULL;
+	Window trans = None;
+	XWindowChanges wc;
+	SavedClient *sc;
+
+	c = ecalloc(1, sizeof(Client));
+	c->win = w;
+	/* geometry */
+	c->x = c->oldx = wa->x;
+	c->y = c->oldy = wa->y;
+	c->w = c->oldw = wa->width;
+	c->h = c->oldh = wa->height;
+	c->oldbw = wa->border_width;
+
+	updatetitle(c);
+	if ((sc = savedclient(w))) {
+		/* restarted: put it back where it was, skipping the rules */
+		for (c->mon = mons; c->mon && c->mon->num != sc->mon; c->mon = c->mon->next);
+		if (!c->mon)
+			c->mon = selmon;
+		c->tags = sc->tags & TAGMASK ? sc->tags & TAGMASK : c->mon->tagset[c->mon->seltags];
+		c->isfloating = sc->isfloating;
+		c->x = c->oldx = sc->x;
+		c->y = c->oldy = sc->y;
+		c->w = c->oldw = sc->w;
+		c->h = c->oldh = sc->h;
+		c->oldbw = sc->oldbw;
+		gettransient(w, &trans);
+	} else if (gettransient(w, &trans) && (t = wintoclient(trans))) {
+		c->mon = t->mon;
+		c->tags = t->tags;
+	} else {
+		c->mon = selmon;
+		applyrules(c);
+	}
+
+	if (c->x + WIDTH(c) > c->mon->mx + c->mon->mw)
+		c->x = c->mon->mx + c->mon->mw - WIDTH(c);
+	if (c->y + HEIGHT(c) > c->mon->my + c->mon->mh)
+		c->y = c->mon->my + c->mon->mh - HEIGHT(c);
+	c->x = MAX(c->x, c->mon->mx);
 	/* only fix client y-offset, if the client center might cover the bar */
 	c->y = MAX(c->y, ((c->mon->by == c->mon->my) && (c->x + (c->w / 2) >= c->mon->wx)
 		&& (c->x + (c->w / 2) < c->mon->wx + c->mon->ww)) ? bh : c->mon->my);
-	c->bw = borderpx;
+	c->bw = c->abw = borderpx;
 
 	wc.border_width = c->bw;
 	XConfigureWindow(dpy, w, CWBorderWidth, &wc);
@@ -1247,11 +2174,16 @@ manage(Window w, XWindowAttributes *wa)
 		c->isfloating = c->oldstate = trans != None || c->isfixed;
 	if (c->isfloating)
 		XRaiseWindow(dpy, c->win);
+	winmapset(c->win, c, NULL);
 	attach(c);
 	attachstack(c);
 	XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32, PropModeAppend,
 		(unsigned char *) &(c->win), 1);
 	XMoveResizeWindow(dpy, c->win, c->x + 2 * sw, c->y, c->w, c->h); /* some windows require this */
+	c->ax = c->x + 2 * sw;
+	c->ay = c->y;
+	c->aw = c->w;
+	c->ah = c->h;
 	setclientstate(c, NormalState);
 	if (c->mon == selmon)
 		unfocus(selmon->sel, 0);
@@ -1277,12 +2209,12 @@ maprequest(XEvent *e)
 	static XWindowAttributes wa;
 	XMapRequestEvent *ev = &e->xmaprequest;
 
-	if (!XGetWindowAttributes(dpy, ev->window, &wa))
-		return;
-	if (wa.override_redirect)
+	if (wintoclient(ev->window))
 		return;
-	if (!wintoclient(ev->window))
+	prefetch(&ev->window, 1);
+	if (getattrs(ev->window, &wa) && !wa.override_redirect)
 		manage(ev->window, &wa);
+	prefetchfree();
 }
 
 void
@@ -1331,6 +2263,7 @@ movemouse(const Arg *arg)
 	if (c->isfullscreen) /* no support moving fullscreen windows by mouse */
 		return;
 	restack(selmon);
+	refresh();
 	ocx = c->x;
 	ocy = c->y;
 	if (XGrabPointer(dpy, root, False, MOUSEMASK, GrabModeAsync, GrabModeAsync,
@@ -1368,6 +2301,7 @@ movemouse(const Arg *arg)
 				resize(c, nx, ny, c->w, c->h, 1);
 			break;
 		}
+		refresh();
 	} while (ev.type != ButtonRelease);
 	XUngrabPointer(dpy, CurrentTime);
 	if ((m = recttomon(c->x, c->y, c->w, c->h)) != selmon) {
@@ -1393,6 +2327,112 @@ pop(Client *c)
 	arrange(c->mon);
 }
 
+/* Ask for everything manage() and scan() read about the given windows in
+ * one go and wait for the replies together, instead of one round-trip per
+ * property. Lookups fall back to plain Xlib for windows not prefetched. */
+void
+prefetch(Window *wins, unsigned int n)
+{
+#ifdef XCB
+	xcb_connection_t *xc = XGetXCBConnection(dpy);
+	xcb_get_window_attributes_cookie_t *ac;
+	xcb_get_geometry_cookie_t *gc;
+	xcb_get_property_cookie_t *pc;
+	xcb_generic_error_t *err;
+	unsigned int i, j;
+
+	prefetchfree();
+	if (!n)
+		return;
+	pfatoms[PfTransient] = XA_WM_TRANSIENT_FOR;
+	pfatoms[PfNetName] = netatom[NetWMName];
+	pfatoms[PfName] = XA_WM_NAME;
+	pfatoms[PfNetState] = netatom[NetWMState];
+	pfatoms[PfNetType] = netatom[NetWMWindowType];
+	pfatoms[PfClass] = XA_WM_CLASS;
+	pfatoms[PfNormalHints] = XA_WM_NORMAL_HINTS;
+	pfatoms[PfHints] = XA_WM_HINTS;
+	pfatoms[PfState] = wmatom[WMState];
+
+	ac = ecalloc(n, sizeof(*ac));
+	gc = ecalloc(n, sizeof(*gc));
+	pc = ecalloc(n * PfLast, sizeof(*pc));
+	for (i = 0; i < n; i++) {
+		ac[i] = xcb_get_window_attributes(xc, wins[i]);
+		gc[i] = xcb_get_geometry(xc, wins[i]);
+		for (j = 0; j < PfLast; j++)
+			pc[i * PfLast + j] = xcb_get_property(xc, 0, wins[i], pfatoms[j],
+				XCB_GET_PROPERTY_TYPE_ANY, 0, 256);
+	}
+
+	pf = ecalloc(n, sizeof(Prefetch));
+	for (i = 0; i < n; i++) {
+		pf[i].win = wins[i];
+		pf[i].attr = xcb_get_window_attributes_reply(xc, ac[i], &err);
+		free(err);
+		pf[i].geom = xcb_get_geometry_reply(xc, gc[i], &err);
+		free(err);
+		for (j = 0; j < PfLast; j++) {
+			pf[i].prop[j] = xcb_get_property_reply(xc, pc[i * PfLast + j], &err);
+			free(err);
+		}
+	}
+	npf = n;
+	free(ac);
+	free(gc);
+	free(pc);
+#endif /* XCB */
+}
+
+void
+prefetchfree(void)
+{
+#ifdef XCB
+	unsigned int i, j;
+
+	for (i = 0; i < npf; i++) {
+		free(pf[i].attr);
+		free(pf[i].geom);
+		for (j = 0; j < PfLast; j++)
+			free(pf[i].prop[j]);
+	}
+	free(pf);
+	pf = NULL;
+	npf = 0;
+#endif /* XCB */
+}
+
+#ifdef XCB
+/* Whether atom was prefetched for w; *r is NULL if the request failed */
+int
+prefetched(Window w, Atom atom, xcb_get_property_reply_t **r)
+{
+	Prefetch *p;
+	int i;
+
+	if (!(p = prefetchwin(w)))
+		return 0;
+	for (i = 0; i < PfLast; i++) {
+		if (pfatoms[i] == atom) {
+			*r = p->prop[i];
+			return 1;
+		}
+	}
+	return 0;
+}
+
+Prefetch *
+prefetchwin(Window w)
+{
+	unsigned int i;
+
+	for (i = 0; i < npf; i++)
+		if (pf[i].win == w)
+			return &pf[i];
+	return NULL;
+}
+#endif /* XCB */
+
 void
 propertynotify(XEvent *e)
 {
@@ -1408,7 +2448,7 @@ propertynotify(XEvent *e)
 		switch(ev->atom) {
 		default: break;
 		case XA_WM_TRANSIENT_FOR:
-			if (!c->isfloating && (XGetTransientForHint(dpy, c->win, &trans)) &&
+			if (!c->isfloating && (gettransient(c->win, &trans)) &&
 				(c->isfloating = (wintoclient(trans)) != NULL))
 				arrange(c->mon);
 			break;
@@ -1450,6 +2490,146 @@ recttomon(int x, int y, int w, int h)
 	return r;
 }
 
+/* Carry out the layout, stacking and bar work that handlers asked for
+ * since the last call, once per monitor. */
+void
+refresh(void)
+{
+	Monitor *m;
+	XEvent ev;
+	int stacked = 0;
+
+	/* layouts only record target geometry, showhide() sends the diff */
+	batchgeom = 1;
+	layoutreqs = 0;
+	for (m = mons; m; m = m->next)
+		if (m->dirty & DirtyLayout)
+			arrangemon(m);
+	for (m = mons; m; m = m->next)
+		if (m->dirty & DirtyLayout)
+			showhide(m->stack);
+	batchgeom = 0;
+	if (layoutstats && layoutreqs)
+		fprintf(stderr, "dwm: layout pass sent %u requests\n", layoutreqs);
+
+	for (m = mons; m; m = m->next) {
+		if (m->dirty & DirtyStack) {
+			restackmon(m);
+			stacked = 1;
+		}
+		if (m->dirty & DirtyBar)
+			renderbar(m);
+		else if (m->dirty & DirtyStatus && m == selmon)
+			drawstatusbar(m, 1);
+		m->dirty = 0;
+	}
+	if (stacked) {
+		/* drop the crossing events restacking caused */
+		XSync(dpy, False);
+		while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
+	}
+	ipcnotify(NULL);
+}
+
+void
+renderbar(Monitor *m)
+{
+	int x, w, sw = 0;
+	int boxs = drw->fonts->h / 9;
+	int boxw = drw->fonts->h / 6 + 2;
+	unsigned int i, occ = 0, urg = 0;
+	Client *c;
+
+	/* draw status first so it can be overdrawn by tags later */
+	if (m == selmon) { /* status is only drawn on selected monitor */
+		sw = m->ww - drawstatusbar(m, 0);
+	}
+
+	for (c = m->clients; c; c = c->next) {
+		occ |= c->tags;
+		if (c->isurgent)
+			urg |= c->tags;
+	}
+	x = 0;
+	for (i = 0; i < LENGTH(tags); i++) {
+		w = TEXTW(tags[i]);
+		drw_setscheme(drw, scheme[m->tagset[m->seltags] & 1 << i ? SchemeSel : SchemeNorm]);
+		drw_text(drw, x, 0, w, bh, lrpad / 2, tags[i], urg & 1 << i);
+		if (occ & 1 << i)
+			drw_rect(drw, x + boxs, boxs, boxw, boxw,
+				m == selmon && selmon->sel && selmon->sel->tags & 1 << i,
+				urg & 1 << i);
+		x += w;
+	}
+	w = blw = TEXTW(m->ltsymbol);
+	drw_setscheme(drw, scheme[SchemeNorm]);
+	x = drw_text(drw, x, 0, w, bh, lrpad / 2, m->ltsymbol, 0);
+
+	if ((w = m->ww - sw - x) > bh) {
+		if (m->sel) {
+			drw_setscheme(drw, scheme[m == selmon ? SchemeSel : SchemeNorm]);
+			drw_text(drw, x, 0, w, bh, lrpad / 2, m->sel->name, 0);
+			if (m->sel->isfloating)
+				drw_rect(drw, x + boxs, boxs, boxw, boxw, m->sel->isfixed, 0);
+		} else {
+			drw_setscheme(drw, scheme[SchemeNorm]);
+			drw_rect(drw, x, 0, w, bh, 1, 1);
+		}
+	}
+	drw_map(drw, m->barwin, 0, 0, m->ww, bh);
+}
+
+void
+renderblock(StatusBlock *b, int x)
+{
+	int i;
+	StatusOp *op;
+
+	drw_setscheme(drw, scheme[LENGTH(colors)]);
+	drw->scheme[ColFg] = scheme[SchemeNorm][ColFg];
+	drw->scheme[ColBg] = scheme[SchemeNorm][ColBg];
+	drw_rect(drw, x, 0, b->w, bh, 1, 1);
+
+	for (i = 0; i < b->nops; i++) {
+		op = &b->ops[i];
+		switch (op->type) {
+		case StText:
+			drw_text(drw, x + op->x, 0, op->w, bh, 0, op->text, 0);
+			break;
+		case StFg:
+			drw->scheme[ColFg] = *op->clr;
+			break;
+		case StBg:
+			drw->scheme[ColBg] = *op->clr;
+			break;
+		case StReset:
+			drw->scheme[ColFg] = scheme[SchemeNorm][ColFg];
+			drw->scheme[ColBg] = scheme[SchemeNorm][ColBg];
+			break;
+		case StRect:
+			drw_rect(drw, x + op->x, op->y, op->w, op->h, 1, op->invert);
+			break;
+		case StGraph:
+			drawgraph(op, x + op->x);
+			break;
+		}
+	}
+	drw_setscheme(drw, scheme[SchemeNorm]);
+
+	b->stale = 0;
+	if (!b->w)
+		return;
+	if (b->pix && b->pw != b->w) {
+		XFreePixmap(dpy, b->pix);
+		b->pix = None;
+	}
+	if (!b->pix) {
+		b->pix = XCreatePixmap(dpy, root, b->w, bh, depth);
+		b->pw = b->w;
+	}
+	XCopyArea(dpy, drw->drawable, b->pix, drw->gc, x, 0, b->w, bh, 0, 0);
+}
+
 void
 resize(Client *c, int x, int y, int w, int h, int interact)
 {
@@ -1460,15 +2640,14 @@ resize(Client *c, int x, int y, int w, int h, int interact)
 void
 resizeclient(Client *c, int x, int y, int w, int h)
 {
-	XWindowChanges wc;
-
-	c->oldx = c->x; c->x = wc.x = x;
-	c->oldy = c->y; c->y = wc.y = y;
-	c->oldw = c->w; c->w = wc.width = w;
-	c->oldh = c->h; c->h = wc.height = h;
-	wc.border_width = c->bw;
-	XConfigureWindow(dpy, c->win, CWX|CWY|CWWidth|CWHeight|CWBorderWidth, &wc);
-	configure(c);
+	c->oldx = c->x; c->x = x;
+	c->oldy = c->y; c->y = y;
+	c->oldw = c->w; c->w = w;
+	c->oldh = c->h; c->h = h;
+	c->resized = 1;
+	if (batchgeom)
+		return;
+	applygeom(c);
 	XSync(dpy, False);
 }
 
@@ -1486,6 +2665,7 @@ resizemouse(const Arg *arg)
 	if (c->isfullscreen) /* no support resizing fullscreen windows by mouse */
 		return;
 	restack(selmon);
+	refresh();
 	ocx = c->x;
 	ocy = c->y;
 	if (XGrabPointer(dpy, root, False, MOUSEMASK, GrabModeAsync, GrabModeAsync,
@@ -1518,6 +2698,7 @@ resizemouse(const Arg *arg)
 				resize(c, c->x, c->y, nw, nh, 1);
 			break;
 		}
+		refresh();
 	} while (ev.type != ButtonRelease);
 	XWarpPointer(dpy, None, c->win, 0, 0, 0, 0, c->w + c->bw - 1, c->h + c->bw - 1);
 	XUngrabPointer(dpy, CurrentTime);
@@ -1531,27 +2712,35 @@ resizemouse(const Arg *arg)
 
 void
 restack(Monitor *m)
+{
+	m->dirty |= DirtyStack|DirtyBar;
+}
+
+void
+restackmon(Monitor *m)
 {
 	Client *c;
-	XEvent ev;
-	XWindowChanges wc;
+	Window *wins;
+	int n = 1;
 
-	drawbar(m);
 	if (!m->sel)
 		return;
 	if (m->sel->isfloating || !m->lt[m->sellt]->arrange)
 		XRaiseWindow(dpy, m->sel->win);
 	if (m->lt[m->sellt]->arrange) {
-		wc.stack_mode = Below;
-		wc.sibling = m->barwin;
+		/* tiled clients go below the bar in focus order, in one request */
 		for (c = m->stack; c; c = c->snext)
-			if (!c->isfloating && ISVISIBLE(c)) {
-				XConfigureWindow(dpy, c->win, CWSibling|CWStackMode, &wc);
-				wc.sibling = c->win;
-			}
+			n++;
+		wins = ecalloc(n, sizeof(Window));
+		wins[0] = m->barwin;
+		n = 1;
+		for (c = m->stack; c; c = c->snext)
+			if (!c->isfloating && ISVISIBLE(c))
+				wins[n++] = c->win;
+		if (n > 1)
+			XRestackWindows(dpy, wins, n);
+		free(wins);
 	}
-	XSync(dpy, False);
-	while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
 }
 
 void
@@ -1561,18 +2750,140 @@ restart(const Arg *arg)
     if (argv[0] == NULL)
         return;
 
+    savestate();
     execv(argv[0], argv);
+    XDeleteProperty(dpy, root, wmatom[WMDwmState]);
+}
+
+/* Put clients back into the list and focus order they had before restart,
+ * manage() only ever prepends. Unknown clients stay in front. */
+void
+restoreorder(void)
+{
+	Client *c, **cs;
+	Monitor *m;
+	SavedClient *sc;
+	int i, j, k, n, stack, *key;
+
+	for (m = mons; m; m = m->next) {
+		for (n = 0, c = m->clients; c; c = c->next, n++);
+		if (n < 2)
+			continue;
+		cs = ecalloc(n, sizeof(Client *));
+		key = ecalloc(n, sizeof(int));
+		for (stack = 0; stack < 2; stack++) {
+			/* insertion sort, lists are short */
+			for (i = 0, c = stack ? m->stack : m->clients; c; c = stack ? c->snext : c->next, i++) {
+				sc = savedclient(c->win);
+				k = !sc ? -1 : stack ? sc->stackorder : sc->order;
+				for (j = i; j > 0 && key[j - 1] > k; j--) {
+					cs[j] = cs[j - 1];
+					key[j] = key[j - 1];
+				}
+				cs[j] = c;
+				key[j] = k;
+			}
+			for (i = 0; i < n; i++) {
+				if (stack)
+					cs[i]->snext = i + 1 < n ? cs[i + 1] : NULL;
+				else
+					cs[i]->next = i + 1 < n ? cs[i + 1] : NULL;
+			}
+			if (stack)
+				m->stack = cs[0];
+			else
+				m->clients = cs[0];
+		}
+		free(cs);
+		free(key);
+	}
 }
 
 void
 run(void)
 {
 	XEvent ev;
+	fd_set fds;
+	int xfd = ConnectionNumber(dpy), maxfd;
+
 	/* main event loop */
 	XSync(dpy, False);
-	while (running && !XNextEvent(dpy, &ev))
+	while (running) {
+		if (!XPending(dpy)) {
+			refresh();
+			/* refresh() may have queued events while syncing */
+			if (XPending(dpy))
+				continue;
+			FD_ZERO(&fds);
+			FD_SET(xfd, &fds);
+			maxfd = ipcfds(&fds, xfd);
+			if (select(maxfd + 1, &fds, NULL, NULL, NULL) == -1) {
+				if (errno == EINTR)
+					continue;
+				die("select:");
+			}
+			ipchandle(&fds);
+			continue;
+		}
+		XNextEvent(dpy, &ev);
 		if (handler[ev.type])
 			handler[ev.type](&ev); /* call handler */
+	}
+}
+
+SavedClient *
+savedclient(Window w)
+{
+	int i;
+
+	for (i = 0; i < nsaved; i++)
+		if (saved[i].win == w)
+			return &saved[i];
+	return NULL;
+}
+
+/* Leave monitors and clients in _DWM_STATE on the root window for the
+ * dwm we are about to exec, see loadstate(). */
+void
+savestate(void)
+{
+	Monitor *m;
+	Client *c, *s;
+	char *buf;
+	size_t size = 64, len;
+	int order = 0, stackorder;
+
+	/* lines stay well below 256 bytes; writes are clamped regardless */
+	for (m = mons; m; m = m->next) {
+		size += 256;
+		for (c = m->clients; c; c = c->next)
+			size += 256;
+	}
+	buf = ecalloc(size, 1);
+	len = snprintf(buf, size, "dwm-state 1\ns %d\n", selmon->num);
+	len = MIN(len, size);
+	for (m = mons; m; m = m->next) {
+		len += snprintf(buf + len, size - len, "m %d %u %u %u %u %d %d %f %d %d\n",
+			m->num, m->tagset[0], m->tagset[1], m->seltags, m->sellt,
+			(int)(m->lt[0] - layouts), (int)(m->lt[1] - layouts),
+			m->mfact, m->nmaster, m->showbar);
+		len = MIN(len, size);
+		for (c = m->clients; c; c = c->next) {
+			for (stackorder = 0, s = m->stack; s && s != c; s = s->snext, stackorder++);
+			/* a fullscreen client comes back through _NET_WM_STATE */
+			len += snprintf(buf + len, size - len, "c %lu %d %u %d %d %d %d %d %d %d %d\n",
+				c->win, m->num, c->tags,
+				c->isfullscreen ? c->oldstate : c->isfloating,
+				c->isfullscreen ? c->oldx : c->x, c->isfullscreen ? c->oldy : c->y,
+				c->isfullscreen ? c->oldw : c->w, c->isfullscreen ? c->oldh : c->h,
+				c->oldbw, order++, stackorder);
+			len = MIN(len, size);
+		}
+	}
+	XChangeProperty(dpy, root, wmatom[WMDwmState], XA_STRING, 8, PropModeReplace,
+		(unsigned char *)buf, MIN(len, size - 1));
+	XSync(dpy, False);
+	free(buf);
 }
 
 void
@@ -1581,25 +2892,47 @@ scan(void)
 	unsigned int i, num;
 	Window d1, d2, *wins = NULL;
 	XWindowAttributes wa;
+	Monitor *m;
+	Client *c;
 
+	loadstate();
 	if (XQueryTree(dpy, root, &d1, &d2, &wins, &num)) {
+		prefetch(wins, num);
 		for (i = 0; i < num; i++) {
-			if (!XGetWindowAttributes(dpy, wins[i], &wa)
-			|| wa.override_redirect || XGetTransientForHint(dpy, wins[i], &d1))
+			if (!getattrs(wins[i], &wa)
+			|| wa.override_redirect || gettransient(wins[i], &d1))
 				continue;
 			if (wa.map_state == IsViewable || getstate(wins[i]) == IconicState)
 				manage(wins[i], &wa);
 		}
 		for (i = 0; i < num; i++) { /* now the transients */
-			if (!XGetWindowAttributes(dpy, wins[i], &wa))
+			if (!getattrs(wins[i], &wa))
 				continue;
-			if (XGetTransientForHint(dpy, wins[i], &d1)
+			if (gettransient(wins[i], &d1)
 			&& (wa.map_state == IsViewable || getstate(wins[i]) == IconicState))
 				manage(wins[i], &wa);
 		}
+		prefetchfree();
 		if (wins)
 			XFree(wins);
 	}
+	if (saved) {
+		restoreorder();
+		/* manage() left the last managed client selected */
+		for (m = mons; m; m = m->next) {
+			for (c = m->stack; c && !ISVISIBLE(c); c = c->snext);
+			m->sel = c;
+		}
+		for (m = mons; m && m->num != savedsel; m = m->next);
+		if (m)
+			selmon = m;
+		free(saved);
+		saved = NULL;
+		nsaved = 0;
+		updateclientlist();
+		focus(NULL);
+		arrange(NULL);
+	}
 }
 
 void
@@ -1618,6 +2951,76 @@ sendmon(Client *c, Monitor *m)
 	arrange(NULL);
 }
 
+void
+seriesappend(Series *sr, int v)
+{
+	int i, j;
+
+	sr->v[sr->head] = v;
+	sr->head = (sr->head + 1) % LENGTH(sr->v);
+	sr->n++;
+	/* only the blocks drawing this series need to be redrawn */
+	for (i = 0; i < nstblocks; i++)
+		for (j = 0; j < stblocks[i].nops; j++)
+			if (stblocks[i].ops[j].type == StGraph && stblocks[i].ops[j].series == sr) {
+				stblocks[i].stale = 1;
+				selmon->dirty |= DirtyStatus;
+				break;
+			}
+}
+
+/* Only appending creates a series, so a mistyped ^G cannot use up the
+ * slots. Graphs compiled before their series existed are looked up again. */
+Series *
+seriesget(const char *name, int create)
+{
+	int i, j;
+
+	for (i = 0; i < nstseries; i++)
+		if (!strcmp(stseries[i].name, name))
+			return &stseries[i];
+	if (!create || nstseries == LENGTH(stseries))
+		return NULL;
+	snprintf(stseries[nstseries].name, sizeof stseries[0].name, "%s", name);
+	nstseries++;
+	for (i = 0; i < nstblocks; i++)
+		for (j = 0; j < stblocks[i].nops; j++)
+			if (stblocks[i].ops[j].type == StGraph && !stblocks[i].ops[j].series) {
+				compilestatus(&stblocks[i]);
+				break;
+			}
+	return &stseries[nstseries - 1];
+}
+
+/* i-th newest value, 0 for the newest */
+int
+seriesval(Series *sr, int i)
+{
+	if ((unsigned int)i >= sr->n || i >= LENGTH(sr->v))
+		return 0;
+	return sr->v[(sr->head - 1 - i + LENGTH(sr->v)) % LENGTH(sr->v)];
+}
+
+/* Returns whether the blocks after i moved. */
+int
+setblock(int i, const char *text)
+{
+	StatusBlock *b = &stblocks[i];
+	size_t len = strlen(text) + 1;
+	int w;
+
+	if (i < nstblocks && !strcmp(b->text, text))
+		return 0;
+	w = i < nstblocks ? b->w : -1;
+	free(b->text);
+	free(b->buf);
+	b->text = ecalloc(len, 1);
+	b->buf = ecalloc(len, 1);
+	memcpy(b->text, text, len);
+	compilestatus(b);
+	return b->w != w;
+}
+
 void
 setclientstate(Client *c, long state)
 {
@@ -1726,7 +3129,8 @@ setup(void)
 {
 	int i;
 	XSetWindowAttributes wa;
-	Atom utf8string;
+	Atom utf8string, atoms[WMLast + NetLast + 1];
+	char *atomnames[WMLast + NetLast + 1];
 
 	/* clean up any zombies immediately */
 	sigchld(0);
@@ -1743,20 +3147,13 @@ setup(void)
 	bh = drw->fonts->h + tbpad;
 	updategeom();
 	/* init atoms */
-	utf8string = XInternAtom(dpy, "UTF8_STRING", False);
-	wmatom[WMProtocols] = XInternAtom(dpy, "WM_PROTOCOLS", False);
-	wmatom[WMDelete] = XInternAtom(dpy, "WM_DELETE_WINDOW", False);
-	wmatom[WMState] = XInternAtom(dpy, "WM_STATE", False);
-	wmatom[WMTakeFocus] = XInternAtom(dpy, "WM_TAKE_FOCUS", False);
-	netatom[NetActiveWindow] = XInternAtom(dpy, "_NET_ACTIVE_WINDOW", False);
-	netatom[NetSupported] = XInternAtom(dpy, "_NET_SUPPORTED", False);
-	netatom[NetWMName] = XInternAtom(dpy, "_NET_WM_NAME", False);
-	netatom[NetWMState] = XInternAtom(dpy, "_NET_WM_STATE", False);
-	netatom[NetWMCheck] = XInternAtom(dpy, "_NET_SUPPORTING_WM_CHECK", False);
-	netatom[NetWMFullscreen] = XInternAtom(dpy, "_NET_WM_STATE_FULLSCREEN", False);
-	netatom[NetWMWindowType] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE", False);
-	netatom[NetWMWindowTypeDialog] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DIALOG", False);
-	netatom[NetClientList] = XInternAtom(dpy, "_NET_CLIENT_LIST", False);
+	memcpy(atomnames, wmatomnames, sizeof wmatomnames);
+	memcpy(atomnames + WMLast, netatomnames, sizeof netatomnames);
+	atomnames[WMLast + NetLast] = "UTF8_STRING";
+	XInternAtoms(dpy, atomnames, LENGTH(atomnames), False, atoms);
+	memcpy(wmatom, atoms, sizeof wmatom);
+	memcpy(netatom, atoms + WMLast, sizeof netatom);
+	utf8string = atoms[WMLast + NetLast];
 	/* init cursors */
 	cursor[CurNormal] = drw_cur_create(drw, XC_left_ptr);
 	cursor[CurResize] = drw_cur_create(drw, XC_sizing);
@@ -1790,6 +3187,7 @@ setup(void)
 	XSelectInput(dpy, root, wa.event_mask);
 	grabkeys();
 	focus(NULL);
+	ipcinit();
 }
 
 
@@ -1813,14 +3211,14 @@ showhide(Client *c)
 		return;
 	if (ISVISIBLE(c)) {
 		/* show clients top down */
-		XMoveWindow(dpy, c->win, c->x, c->y);
 		if ((!c->mon->lt[c->mon->sellt]->arrange || c->isfloating) && !c->isfullscreen)
 			resize(c, c->x, c->y, c->w, c->h, 0);
+		applygeom(c);
 		showhide(c->snext);
 	} else {
 		/* hide clients bottom up */
 		showhide(c->snext);
-		XMoveWindow(dpy, c->win, WIDTH(c) * -2, c->y);
+		applygeom(c);
 	}
 }
 
@@ -1848,6 +3246,95 @@ spawn(const Arg *arg)
 	}
 }
 
+/* Apply and cut out ^a<name>,<value>^ codes. They feed graph series on
+ * every update, even a repeated one, and must not change the blocks. */
+void
+statusappends(char *text)
+{
+	char *s, *d, *e, *v;
+	Series *sr;
+	int incode = 0;
+
+	for (s = d = text; *s;) {
+		if (*s == '^' && !incode && s[1] == 'a' && (e = strchr(s + 2, '^'))) {
+			*e = '\0';
+			if ((v = strchr(s + 2, ','))) {
+				*v++ = '\0';
+				if ((sr = seriesget(s + 2, 1)))
+					seriesappend(sr, atoi(v));
+			}
+			s = e + 1;
+			continue;
+		}
+		if (*s == '^')
+			incode = !incode;
+		*d++ = *s++;
+	}
+	*d = '\0';
+}
+
+/* Parse n comma separated integers following the code letter at s;
+ * returns the last character consumed. */
+char *
+statusargs(char *s, int *v, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		v[i] = strtol(s + 1, &s, 10);
+		if (*s != ',')
+			break;
+	}
+	return s - 1;
+}
+
+void
+statuschanged(int moved)
+{
+	int i;
+
+	if (!moved) {
+		selmon->dirty |= DirtyStatus;
+		return;
+	}
+	for (stw = 2, i = 0; i < nstblocks; i++) /* 1px padding on both sides */
+		stw += stblocks[i].w;
+	drawbar(selmon);
+}
+
+Clr *
+statuscolor(const char *name)
+{
+	unsigned long rgb;
+	StatusColor *sc;
+	unsigned int h;
+
+	rgb = name[0] == '#' ? strtoul(name + 1, NULL, 16) : 0;
+	h = (rgb ^ rgb >> 8 ^ rgb >> 16) & (LENGTH(stcolors) - 1);
+	for (sc = stcolors[h]; sc; sc = sc->next)
+		if (!strcmp(sc->name, name))
+			return &sc->clr;
+	sc = ecalloc(1, sizeof(StatusColor));
+	strcpy(sc->name, name);
+	drw_clr_create(drw, &sc->clr, name, alpha_scheme[ColFg]);
+	sc->next = stcolors[h];
+	stcolors[h] = sc;
+	return &sc->clr;
+}
+
+StatusOp *
+statusop(int type)
+{
+	StatusOp *op;
+
+	if (stlen >= LENGTH(stops))
+		return NULL;
+	op = &stops[stlen++];
+	memset(op, 0, sizeof *op);
+	op->type = type;
+	return op;
+}
+
 void
 tag(const Arg *arg)
 {
@@ -1978,6 +3465,7 @@ unmanage(Client *c, int destroyed)
 		XSetErrorHandler(xerror);
 		XUngrabServer(dpy);
 	}
+	winmapdel(c->win);
 	free(c);
 	focus(NULL);
 	updateclientlist();
@@ -2019,6 +3507,7 @@ updatebars(void)
 		XDefineCursor(dpy, m->barwin, cursor[CurNormal]->cursor);
 		XMapRaised(dpy, m->barwin);
 		XSetClassHint(dpy, m->barwin, &ch);
+		winmapset(m->barwin, NULL, m);
 	}
 }
 
@@ -2040,13 +3529,20 @@ updateclientlist()
 {
 	Client *c;
 	Monitor *m;
+	Window *wins;
+	int n = 0;
 
-	XDeleteProperty(dpy, root, netatom[NetClientList]);
 	for (m = mons; m; m = m->next)
 		for (c = m->clients; c; c = c->next)
-			XChangeProperty(dpy, root, netatom[NetClientList],
-				XA_WINDOW, 32, PropModeAppend,
-				(unsigned char *) &(c->win), 1);
+			n++;
+	wins = ecalloc(MAX(n, 1), sizeof(Window));
+	n = 0;
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next)
+			wins[n++] = c->win;
+	XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32,
+		PropModeReplace, (unsigned char *) wins, n);
+	free(wins);
 }
 
 int
@@ -2146,10 +3642,9 @@ updatenumlockmask(void)
 void
 updatesizehints(Client *c)
 {
-	long msize;
 	XSizeHints size;
 
-	if (!XGetWMNormalHints(dpy, c->win, &size, &msize))
+	if (!getnormalhints(c->win, &size))
 		/* size is uninitialized, ensure that size.flags aren't used */
 		size.flags = PSize;
 	if (size.flags & PBaseSize) {
@@ -2189,9 +3684,23 @@ updatesizehints(Client *c)
 void
 updatestatus(void)
 {
-	if (!gettextprop(root, XA_WM_NAME, stext, sizeof(stext)))
-		strcpy(stext, "dwm-"VERSION);
-	drawbar(selmon);
+	char text[sizeof stext], *s, *e;
+	int i, moved = 0;
+
+	if (!gettextprop(root, XA_WM_NAME, text, sizeof(text)))
+		strcpy(text, "dwm-"VERSION);
+	statusappends(text);
+	if (nstblocks && !strcmp(text, stext))
+		return;
+	strcpy(stext, text);
+	for (i = 0, s = text; s && i < LENGTH(stblocks); i++, s = e ? e + 1 : NULL) {
+		if ((e = strchr(s, statussep)))
+			*e = '\0';
+		moved |= setblock(i, s);
+	}
+	moved |= i != nstblocks;
+	nstblocks = i;
+	statuschanged(moved);
 }
 
 void
@@ -2220,7 +3729,7 @@ updatewmhints(Client *c)
 {
 	XWMHints *wmh;
 
-	if ((wmh = XGetWMHints(dpy, c->win))) {
+	if ((wmh = gethints(c->win))) {
 		if (c == selmon->sel && wmh->flags & XUrgencyHint) {
 			wmh->flags &= ~XUrgencyHint;
 			XSetWMHints(dpy, c->win, wmh);
@@ -2246,33 +3755,96 @@ view(const Arg *arg)
 	arrange(selmon);
 }
 
+/* Window -> client/bar map: open addressing with linear probing, kept at
+ * most half full. Deletion shifts the following run back into place, so
+ * there are no tombstones to skip. */
+unsigned int
+winhash(Window w)
+{
+	/* only the high bits of the product depend on all of w, and ids
+	 * of different clients differ in their high bits */
+	return ((unsigned int)w * 2654435761u) >> (32 - wintabbits);
+}
+
+void
+winmapdel(Window w)
+{
+	unsigned int i, j, h;
+
+	if (!wintablen)
+		return;
+	for (i = winhash(w); wintab[i].win != w; i = (i + 1) & (wintabsz - 1))
+		if (!wintab[i].win)
+			return;
+	for (j = (i + 1) & (wintabsz - 1); wintab[j].win; j = (j + 1) & (wintabsz - 1)) {
+		h = winhash(wintab[j].win);
+		/* move j into the hole at i unless its home lies in (i, j] */
+		if ((j > i && (h <= i || h > j)) || (j < i && h <= i && h > j)) {
+			wintab[i] = wintab[j];
+			i = j;
+		}
+	}
+	wintab[i].win = 0;
+	wintablen--;
+}
+
+WinEntry *
+winmapget(Window w)
+{
+	unsigned int i;
+
+	if (!wintablen || !w)
+		return NULL;
+	for (i = winhash(w); wintab[i].win; i = (i + 1) & (wintabsz - 1))
+		if (wintab[i].win == w)
+			return &wintab[i];
+	return NULL;
+}
+
+void
+winmapset(Window w, Client *c, Monitor *m)
+{
+	WinEntry *old;
+	unsigned int i, oldsz;
+
+	if ((wintablen + 1) * 2 > wintabsz) {
+		old = wintab;
+		oldsz = wintabsz;
+		wintabsz = oldsz ? oldsz * 2 : 64;
+		wintabbits = oldsz ? wintabbits + 1 : 6;
+		wintab = ecalloc(wintabsz, sizeof(WinEntry));
+		wintablen = 0;
+		for (i = 0; i < oldsz; i++)
+			if (old[i].win)
+				winmapset(old[i].win, old[i].c, old[i].m);
+		free(old);
+	}
+	for (i = winhash(w); wintab[i].win && wintab[i].win != w; i = (i + 1) & (wintabsz - 1));
+	if (!wintab[i].win)
+		wintablen++;
+	wintab[i].win = w;
+	wintab[i].c = c;
+	wintab[i].m = m;
+}
+
 Client *
 wintoclient(Window w)
 {
-	Client *c;
-	Monitor *m;
+	WinEntry *e;
 
-	for (m = mons; m; m = m->next)
-		for (c = m->clients; c; c = c->next)
-			if (c->win == w)
-				return c;
-	return NULL;
+	return (e = winmapget(w)) ? e->c : NULL;
 }
 
 Monitor *
 wintomon(Window w)
 {
 	int x, y;
-	Client *c;
-	Monitor *m;
+	WinEntry *e;
 
 	if (w == root && getrootptr(&x, &y))
 		return recttomon(x, y, 1, 1);
-	for (m = mons; m; m = m->next)
-		if (w == m->barwin)
-			return m;
-	if ((c = wintoclient(w)))
-		return c->mon;
+	if ((e = winmapget(w)))
+		return e->c ? e->c->mon : e->m;
 	return selmon;
 }
 
@@ -2377,7 +3949,7 @@ main(int argc, char *argv[])
 	checkotherwm();
 	setup();
 #ifdef __OpenBSD__
-	if (pledge("stdio rpath proc exec", NULL) == -1)
+	if (pledge("stdio rpath cpath unix proc exec", NULL) == -1)
 		die("pledge");
 #endif /* __OpenBSD__ */
 	scan();
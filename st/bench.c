@@ -0,0 +1,563 @@
+/* See LICENSE for license details. */
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <locale.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <X11/Xlib.h>
+#include <X11/cursorfont.h>
+#include <X11/keysym.h>
+
+static char *argv0;
+#include "arg.h"
+#include "st.h"
+#include "win.h"
+
+/*
+ * Headless backend: every win.h entry point is a no-op that only counts
+ * what it was asked to do. Linked against st.c it gives a terminal core
+ * that can be driven without an X server, see bench below.
+ */
+
+/* types used in config.h */
+typedef struct {
+	uint mod;
+	KeySym keysym;
+	void (*func)(const Arg *);
+	const Arg arg;
+} Shortcut;
+
+typedef struct {
+	uint b;
+	uint mask;
+	char *s;
+} MouseShortcut;
+
+typedef struct {
+	KeySym k;
+	uint mask;
+	char *s;
+	signed char appkey;
+	signed char appcursor;
+} Key;
+
+/* X modifiers */
+#define XK_ANY_MOD    UINT_MAX
+#define XK_NO_MOD     0
+#define XK_SWITCH_MOD (1<<13)
+
+/* function definitions used in config.h */
+static void clipcopy(const Arg *);
+static void clippaste(const Arg *);
+static void numlock(const Arg *);
+static void selpaste(const Arg *);
+static void zoom(const Arg *);
+static void zoomabs(const Arg *);
+static void zoomreset(const Arg *);
+
+/* config.h for applying patches and the configuration. */
+#include "config.h"
+
+typedef struct {
+	char *name;
+	char *buf;
+	size_t len;
+} Sample;
+
+typedef struct {
+	ulong frames;
+	ulong lines;
+	ulong cells;
+	ulong cursors;
+	ulong titles;
+	ulong bells;
+	ulong allocs;
+	ulong allocbytes;
+} Counters;
+
+static void bufadd(Sample *, const char *, ...);
+static void genplain(Sample *);
+static void genls(Sample *);
+static void gentruecolor(Sample *);
+static void gencjk(Sample *);
+static void genvim(Sample *);
+static void gentmux(Sample *);
+static void gensixel(Sample *);
+static void loadsample(Sample *, char *);
+static void replay(Sample *);
+static void usage(void);
+
+void *__real_malloc(size_t);
+void *__real_calloc(size_t, size_t);
+void *__real_realloc(void *, size_t);
+
+/* Globals */
+static Counters cnt;
+static int bcols = 80, brows = 24;
+static int iterations = 5;
+static int chunksperframe = 1;
+static int dumpstats = 0;
+
+static void (*generators[])(Sample *) = {
+	genplain, genls, gentruecolor, gencjk, genvim, gentmux, gensixel,
+};
+static char *gennames[] = {
+	"plain", "ls", "truecolor", "cjk", "vim", "tmux", "sixel",
+};
+
+/*
+ * Allocation accounting. The bench binary is linked with
+ * -Wl,--wrap=malloc,... so only calls made from st.c and bench.c land here.
+ */
+void *
+__wrap_malloc(size_t n)
+{
+	cnt.allocs++;
+	cnt.allocbytes += n;
+	return __real_malloc(n);
+}
+
+void *
+__wrap_calloc(size_t nmemb, size_t n)
+{
+	cnt.allocs++;
+	cnt.allocbytes += nmemb * n;
+	return __real_calloc(nmemb, n);
+}
+
+void *
+__wrap_realloc(void *p, size_t n)
+{
+	cnt.allocs++;
+	cnt.allocbytes += n;
+	return __real_realloc(p, n);
+}
+
+void clipcopy(const Arg *dummy) {}
+void clippaste(const Arg *dummy) {}
+void numlock(const Arg *dummy) {}
+void selpaste(const Arg *dummy) {}
+void zoom(const Arg *arg) {}
+void zoomabs(const Arg *arg) {}
+void zoomreset(const Arg *arg) {}
+
+void
+xbell(void)
+{
+	cnt.bells++;
+}
+
+void
+xclipcopy(void)
+{
+}
+
+void
+xdrawcursor(int cx, int cy, Glyph g, int ox, int oy, Glyph og)
+{
+	cnt.cursors++;
+}
+
+void
+xdrawline(Line line, int x1, int y1, int x2)
+{
+	cnt.lines++;
+	cnt.cells += x2 - x1;
+}
+
+void
+xfinishdraw(void)
+{
+	cnt.frames++;
+}
+
+int
+ximage(const uint32_t *pixels, int w, int h, int stride, int *cols, int *rows)
+{
+	/* a 10x20 cell, like a common 9pt font */
+	*cols = DIVCEIL(w, 10);
+	*rows = DIVCEIL(h, 20);
+	/* generation 1, slot 0: never 0, like x.c */
+	return 1 << 6;
+}
+
+void
+xloadcols(void)
+{
+}
+
+int
+xsetcolorname(int x, const char *name)
+{
+	return !BETWEEN(x, 0, MAX(LEN(colorname), 256));
+}
+
+void
+xsettitle(char *p)
+{
+	cnt.titles++;
+}
+
+int
+xsetcursor(int cursor)
+{
+	DEFAULT(cursor, 1);
+	return !BETWEEN(cursor, 0, 6);
+}
+
+void
+xsetmode(int set, unsigned int flags)
+{
+}
+
+void
+xsetpointermotion(int set)
+{
+}
+
+void
+xsetsel(char *str)
+{
+	free(str);
+}
+
+int
+xstartdraw(void)
+{
+	return 1;
+}
+
+void
+bufadd(Sample *s, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(NULL, 0, fmt, ap);
+	va_end(ap);
+
+	s->buf = xrealloc(s->buf, s->len + n + 1);
+	va_start(ap, fmt);
+	vsnprintf(s->buf + s->len, n + 1, fmt, ap);
+	va_end(ap);
+	s->len += n;
+}
+
+/*
+ * The generators below are deterministic stand-ins for recorded sessions,
+ * so the numbers stay comparable between machines and commits.
+ */
+void
+genplain(Sample *s)
+{
+	static char *lvl[] = { "INFO", "DEBUG", "WARN", "INFO", "ERROR" };
+	int i;
+
+	for (i = 0; i < 40000; i++) {
+		bufadd(s, "2018-03-%02d 12:%02d:%02d.%03d %-5s [worker-%d] "
+		       "GET /api/v1/items/%d served in %dms (%d bytes)\r\n",
+		       i % 28 + 1, i / 60 % 60, i % 60, i % 1000,
+		       lvl[i % LEN(lvl)], i % 8, i * 7 % 10007,
+		       i * 13 % 97, i * 31 % 65536);
+	}
+}
+
+void
+genls(Sample *s)
+{
+	static char *col[] = { "01;34", "01;32", "0", "01;36", "01;31", "0" };
+	static char *ext[] = { "", ".sh", ".c", "", ".tar.gz", ".h" };
+	int i, j;
+
+	for (i = 0; i < 3000; i++) {
+		bufadd(s, "$ ls --color=auto\r\n");
+		for (j = 0; j < 24; j++) {
+			bufadd(s, "\033[%sm%s%03d%s\033[0m  ",
+			       col[(i + j) % LEN(col)], "entry", j,
+			       ext[(i + j) % LEN(ext)]);
+			if (j % 6 == 5)
+				bufadd(s, "\r\n");
+		}
+	}
+}
+
+void
+gentruecolor(Sample *s)
+{
+	int i, x;
+
+	for (i = 0; i < 2000; i++) {
+		for (x = 0; x < bcols; x++) {
+			bufadd(s, "\033[48;2;%d;%d;%dm\033[38;2;%d;%d;%dm%c",
+			       x * 255 / bcols, (i * 3) % 256,
+			       255 - x * 255 / bcols,
+			       255 - x * 255 / bcols, (i * 5) % 256,
+			       x * 255 / bcols, x % 2 ? '/' : '\\');
+		}
+		bufadd(s, "\033[0m\r\n");
+	}
+}
+
+void
+gencjk(Sample *s)
+{
+	static char *text[] = {
+		"안녕하세요, 세계! ", "漢字かなカナ混じり文。", "中文测试行，",
+		"한글 입력 테스트 ", "日本語の表示速度 ", "ＡＢＣ全角 ",
+	};
+	int i, j;
+
+	for (i = 0; i < 12000; i++) {
+		for (j = 0; j < 4; j++)
+			bufadd(s, "%s", text[(i + j) % LEN(text)]);
+		bufadd(s, "\r\n");
+	}
+}
+
+void
+genvim(Sample *s)
+{
+	static char *syn[] = { "38;5;203", "38;5;81", "38;5;186", "38;5;141" };
+	int i, y;
+
+	/* enter the alternate screen, set up the window */
+	bufadd(s, "\033[?1049h\033[1;%dr\033[?12h\033[?12l"
+	       "\033[27m\033[23m\033[29m\033[m\033[H\033[2J", brows - 1);
+	for (i = 0; i < 3000; i++) {
+		if (i % 50 == 0) {
+			/* full redraw */
+			bufadd(s, "\033[H\033[2J");
+			for (y = 1; y < brows - 1; y++) {
+				bufadd(s, "\033[%d;1H\033[38;5;242m%4d "
+				       "\033[%sm\tstatic int\033[m "
+				       "var_%d = \033[%smcall\033[m(%d);",
+				       y, i + y, syn[y % LEN(syn)], y,
+				       syn[(y + 1) % LEN(syn)], i * y);
+			}
+		} else if (i % 2) {
+			/* scroll down by one line, redraw the new one */
+			bufadd(s, "\033[1;%dr\033[%d;1H\n\033[1;%dr"
+			       "\033[%d;1H\033[K\033[38;5;242m%4d \033[%sm"
+			       "\treturn\033[m value_%d;",
+			       brows - 1, brows - 1, brows, brows - 1,
+			       i, syn[i % LEN(syn)], i);
+		} else {
+			/* insert mode typing */
+			bufadd(s, "\033[%d;%dH\033[%smx\033[m\033[1@y",
+			       i % (brows - 2) + 1, i % (bcols - 10) + 6,
+			       syn[i % LEN(syn)]);
+		}
+		/* status line */
+		bufadd(s, "\033[%d;1H\033[1m-- INSERT --\033[m\033[K"
+		       "\033[%d;%dH%d,%d\033[%d;%dH", brows, brows,
+		       bcols - 18, i, i % 80, i % (brows - 2) + 1, 6);
+	}
+	bufadd(s, "\033[?1049l");
+}
+
+void
+gentmux(Sample *s)
+{
+	int i, half = bcols / 2;
+
+	bufadd(s, "\033[?1049h\033[H\033[2J");
+	for (i = 0; i < 6000; i++) {
+		/* left pane: scrolling region with output */
+		bufadd(s, "\0337\033[1;%dr\033[%d;1H\n\033[%d;1H"
+		       "\033[32muser@host\033[m:\033[34m~\033[m$ make -j%d "
+		       "target_%d\033[K\0338", brows - 1, brows - 1,
+		       brows - 1, i % 16, i);
+		/* border */
+		bufadd(s, "\033(0\033[%d;%dHx\033(B", i % (brows - 1) + 1, half);
+		/* right pane: cursor addressed updates */
+		bufadd(s, "\033[%d;%dH\033[7m %5d \033[27m %d%%",
+		       i % (brows - 1) + 1, half + 2, i, i % 100);
+		/* status bar */
+		if (i % 10 == 0) {
+			bufadd(s, "\033[%d;1H\033[30;42m[0] 0:bash* "
+			       "1:vim- \"host\" %02d:%02d 18-Mar-18"
+			       "\033[K\033[m\033[r", brows, i / 60 % 24,
+			       i % 60);
+		}
+	}
+	bufadd(s, "\033[?1049l");
+}
+
+void
+gensixel(Sample *s)
+{
+	int i, c, y, x;
+
+	for (i = 0; i < 200; i++) {
+		/* 320x120 gradient, as a plotting tool would send it */
+		bufadd(s, "plot %d:\r\n\033P0;1;0q\"1;1;320;120", i);
+		for (c = 0; c < 16; c++) {
+			bufadd(s, "#%d;2;%d;%d;%d", c, c * 6, (i + c) % 100,
+			       100 - c * 6);
+		}
+		for (y = 0; y < 20; y++) {
+			for (c = 0; c < 16; c++) {
+				bufadd(s, "#%d", c);
+				for (x = 0; x < 320; x += 20) {
+					bufadd(s, "!%d%c", 10 + (x + y + c) % 10,
+					       0x3f + ((x / 20 + c + y) % 64));
+					bufadd(s, "!%d?", 10 - (x + y + c) % 10);
+				}
+				bufadd(s, "$");
+			}
+			bufadd(s, "-");
+		}
+		bufadd(s, "\033\\");
+	}
+}
+
+void
+loadsample(Sample *s, char *path)
+{
+	char buf[BUFSIZ];
+	ssize_t r;
+	size_t i, o, len;
+	int fd, shift;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		die("open %s: %s\n", path, strerror(errno));
+	while ((r = read(fd, buf, sizeof(buf))) > 0) {
+		s->buf = xrealloc(s->buf, s->len + r);
+		memcpy(s->buf + s->len, buf, r);
+		s->len += r;
+	}
+	if (r < 0)
+		die("read %s: %s\n", path, strerror(errno));
+	close(fd);
+
+	if (s->len < strlen(REC_MAGIC) ||
+	    memcmp(s->buf, REC_MAGIC, strlen(REC_MAGIC)))
+		return;
+
+	/* session recording: drop the framing, keep the raw bytes */
+	for (i = strlen(REC_MAGIC), o = 0; i < s->len; i += len, o += len) {
+		while (i < s->len && s->buf[i++] & 0x80)
+			; /* delay */
+		for (len = 0, shift = 0; i < s->len; shift += 7) {
+			len |= (size_t)(s->buf[i] & 0x7f) << shift;
+			if (!(s->buf[i++] & 0x80))
+				break;
+		}
+		len = MIN(len, s->len - i);
+		memmove(s->buf + o, s->buf + i, len);
+	}
+	s->len = o;
+}
+
+void
+replay(Sample *s)
+{
+	struct timespec start, end;
+	size_t off, n, total = 0;
+	int i, left, chunks = 0;
+	double ms;
+
+	tnew(bcols, brows);
+	memset(&cnt, 0, sizeof(cnt));
+	memset(&stats, 0, sizeof(stats));
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < iterations; i++) {
+		/* feed ttyread() sized chunks, keeping partial utf8 */
+		for (off = 0, left = 0; off < s->len; off += n) {
+			n = MIN(BUFSIZ - left, s->len - off);
+			left = n + left - twrite(s->buf + off - left,
+			                         n + left, 0);
+			if (++chunks % chunksperframe == 0)
+				draw();
+		}
+		total += s->len;
+	}
+	draw();
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	ms = TIMEDIFF(end, start);
+	if (ms <= 0)
+		ms = 1E-3;
+	printf("%-10s %9.2f MB/s %12.0f cells/s %8lu frames %8lu allocs "
+	       "%10lu bytes %8.1f ms\n", s->name,
+	       total / ms * 1000 / (1024 * 1024), cnt.cells / ms * 1000,
+	       cnt.frames, cnt.allocs, cnt.allocbytes, ms);
+	if (dumpstats)
+		statsdump(stdout);
+}
+
+void
+usage(void)
+{
+	die("usage: %s [-s] [-c cols] [-r rows] [-n iterations]"
+	    " [-f chunks-per-frame] [file ...]\n", argv0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	Sample s;
+	int i, fd;
+
+	ARGBEGIN {
+	case 'c':
+		bcols = atoi(EARGF(usage()));
+		break;
+	case 'r':
+		brows = atoi(EARGF(usage()));
+		break;
+	case 'n':
+		iterations = atoi(EARGF(usage()));
+		break;
+	case 'f':
+		chunksperframe = atoi(EARGF(usage()));
+		break;
+	case 's':
+		dumpstats = 1;
+		break;
+	default:
+		usage();
+	} ARGEND;
+
+	if (bcols < 1 || brows < 3 || iterations < 1 || chunksperframe < 1)
+		usage();
+
+	setlocale(LC_CTYPE, "");
+	if (MB_CUR_MAX == 1 && !setlocale(LC_CTYPE, "C.UTF-8"))
+		fprintf(stderr, "no UTF-8 locale, wide characters will be"
+		        " replaced\n");
+
+	/* answers to terminal queries (DA, DSR) go to the bit bucket */
+	if ((fd = open("/dev/null", O_RDWR)) < 0)
+		die("open /dev/null: %s\n", strerror(errno));
+	dup2(fd, 0);
+	selinit();
+
+	printf("st-bench %dx%d, %d iterations, %d chunks per frame\n",
+	       bcols, brows, iterations, chunksperframe);
+	if (argc > 0) {
+		for (i = 0; i < argc; i++) {
+			s = (Sample){ .name = basename(argv[i]) };
+			loadsample(&s, argv[i]);
+			replay(&s);
+			free(s.buf);
+		}
+	} else {
+		for (i = 0; i < LEN(generators); i++) {
+			s = (Sample){ .name = gennames[i] };
+			generators[i](&s);
+			replay(&s);
+			free(s.buf);
+		}
+	}
+
+	return 0;
+}
@@ -40,11 +40,40 @@ static unsigned int tripleclicktimeout = 600;
 
 /* alt screens */
 int allowaltscreen = 1;
+/* free the alt screen when unused for so long (in milliseconds, 0 = never) */
+unsigned int altscreenidle = 60000;
 
 /* frames per second st should at maximum draw to the screen */
 static unsigned int xfps = 120;
 static unsigned int actionfps = 30;
 
+/*
+ * draw right away when tty output follows a key press, instead of waiting
+ * for the next frame; floods of output are still drawn at xfps
+ */
+static int lowlatency = 0;
+
+/*
+ * statistics of the parser and renderer, dumped to stderr on SIGUSR1 or
+ * with printstats(). If statsfile is set, it is also rewritten every
+ * statsinterval milliseconds while st is busy.
+ */
+static char *statsfile = NULL;
+static unsigned int statsinterval = 5000;
+
+/*
+ * Fallback fonts found by fontconfig are remembered in this file below
+ * $XDG_CACHE_HOME (or ~/.cache), so later instances skip the lookup.
+ * Set to NULL to disable.
+ */
+static char *fallbackcache = "st-fallback";
+
+/*
+ * during interactive resizing, the program in the terminal is told the new
+ * size once the window did not change for resizedelay milliseconds
+ */
+static unsigned int resizedelay = 100;
+
 /*
  * blinking timeout (set to 0 to disable blinking) for the terminal blinking
  * attribute.
@@ -181,6 +210,7 @@ static Shortcut shortcuts[] = {
 	{ TERMMOD,              XK_V,           clippaste,      {.i =  0} },
 	{ TERMMOD,              XK_Y,           selpaste,       {.i =  0} },
 	{ TERMMOD,              XK_Num_Lock,    numlock,        {.i =  0} },
+	{ TERMMOD,              XK_S,           printstats,     {.i =  0} },
 };
 
 /*
@@ -10,19 +10,32 @@ MANPREFIX = $(PREFIX)/share/man
 X11INC = /usr/X11R6/include
 X11LIB = /usr/X11R6/lib
 
+# HarfBuzz shaping for font ligatures, uncomment to enable
+#HBSRC = shape.c
+#HBINC = `pkg-config --cflags harfbuzz`
+#HBLIBS = `pkg-config --libs harfbuzz`
+#HBFLAGS = -DHARFBUZZ
+
 # includes and libs
 INCS = -I. -I/usr/include -I${X11INC} \
        `pkg-config --cflags fontconfig` \
-       `pkg-config --cflags freetype2`
+       `pkg-config --cflags freetype2` \
+       ${HBINC}
 LIBS = -L/usr/lib -lc -L${X11LIB} -lm -lrt -lX11 -lutil -lXft -lXrender\
        `pkg-config --libs fontconfig` \
-       `pkg-config --libs freetype2`
+       `pkg-config --libs freetype2` \
+       ${HBLIBS}
 
 # flags
-CPPFLAGS = -DVERSION=\"$(VERSION)\" -D_XOPEN_SOURCE=600
+CPPFLAGS = -DVERSION=\"$(VERSION)\" -D_XOPEN_SOURCE=600 ${HBFLAGS}
 STCFLAGS = $(INCS) $(CPPFLAGS) $(CFLAGS)
 STLDFLAGS = $(LIBS) $(LDFLAGS)
 
+# headless benchmark, allocations are counted through the linker's --wrap
+BENCHLIBS = -L/usr/lib -lc -lm -lutil
+BENCHLDFLAGS = $(BENCHLIBS) -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc \
+               $(LDFLAGS)
+
 # OpenBSD:
 #CPPFLAGS = -DVERSION=\"$(VERSION)\" -D_XOPEN_SOURCE=600 -D_BSD_SOURCE
 #LIBS = -L$(X11LIB) -lm -lX11 -lutil -lXft \
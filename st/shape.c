@@ -0,0 +1,242 @@
+/* See LICENSE for license details. */
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <X11/Xft/Xft.h>
+#include <hb.h>
+#include <hb-ft.h>
+#include <hb-ot.h>
+
+#include "st.h"
+#include "shape.h"
+
+#define SHAPECACHE_LEN 1024
+
+typedef struct {
+	XftFont *match;
+	double size;
+	hb_font_t *font;
+} HbFont;
+
+typedef struct {
+	FT_UInt glyph;
+	short x, y;     /* offset from the origin of cell */
+	short cell;     /* start of the cluster the glyph belongs to */
+} Shaped;
+
+/* Shaped run cache, direct mapped by the hash of the run. */
+typedef struct {
+	ulong hash;
+	XftFont *match;
+	int len, size;
+	Rune *runes;
+	Shaped *glyphs;
+} Shapedrun;
+
+static hb_font_t *hbfont(XftFont *);
+static Shapedrun *hbshaperun(XftFont *, const Rune *, int);
+
+/* OpenType features applied to every run */
+static hb_feature_t features[] = {
+	{ HB_TAG('l', 'i', 'g', 'a'), 1, 0, UINT_MAX },
+	{ HB_TAG('c', 'a', 'l', 't'), 1, 0, UINT_MAX },
+};
+
+static HbFont *hbfonts;
+static int hbfontslen;
+static hb_buffer_t *buffer;
+static Shapedrun cache[SHAPECACHE_LEN];
+static Rune *runes;
+static int *cols;  /* column of runes[i] in the line */
+static int runeslen;
+
+/* Forget everything, the fonts are about to be closed. */
+void
+hbclear(void)
+{
+	int i;
+
+	for (i = 0; i < hbfontslen; i++)
+		hb_font_destroy(hbfonts[i].font);
+	hbfontslen = 0;
+	for (i = 0; i < SHAPECACHE_LEN; i++)
+		cache[i].match = NULL;
+}
+
+/*
+ * Xft shares one FT_Face between all sizes of a font and resizes it on
+ * every lock, so harfbuzz only takes the tables from it and gets the
+ * size of this XftFont as its own scale, in 26.6 like FreeType.
+ */
+hb_font_t *
+hbfont(XftFont *match)
+{
+	hb_face_t *face;
+	double size;
+	int i;
+
+	if (FcPatternGetDouble(match->pattern, FC_PIXEL_SIZE, 0, &size) !=
+	    FcResultMatch)
+		size = match->height;
+	for (i = 0; i < hbfontslen; i++) {
+		if (hbfonts[i].match == match && hbfonts[i].size == size)
+			return hbfonts[i].font;
+	}
+
+	/* the referenced face outlives Xft closing it */
+	face = hb_ft_face_create_referenced(XftLockFace(match));
+	XftUnlockFace(match);
+
+	hbfonts = xrealloc(hbfonts, (hbfontslen + 1) * sizeof(*hbfonts));
+	hbfonts[i].match = match;
+	hbfonts[i].size = size;
+	hbfonts[i].font = hb_font_create(face);
+	hb_face_destroy(face);
+	hb_ot_font_set_funcs(hbfonts[i].font);
+	hb_font_set_scale(hbfonts[i].font, size * 64, size * 64);
+	hbfontslen++;
+
+	return hbfonts[i].font;
+}
+
+Shapedrun *
+hbshaperun(XftFont *match, const Rune *text, int len)
+{
+	struct timespec start;
+	hb_glyph_info_t *info;
+	hb_glyph_position_t *pos;
+	hb_codepoint_t space;
+	hb_font_t *font;
+	Shapedrun *r;
+	ulong h = (ulong)match;
+	uint count;
+	int i, k, n, c, e, cell, penx, peny;
+
+	for (i = 0; i < len; i++)
+		h = (h ^ text[i]) * 16777619UL;
+	r = &cache[h % SHAPECACHE_LEN];
+	if (r->match == match && r->hash == h && r->len == len &&
+	    !memcmp(r->runes, text, len * sizeof(Rune))) {
+		stats.shapehit++;
+		return r;
+	}
+	stats.shapemiss++;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (!buffer)
+		buffer = hb_buffer_create();
+	font = hbfont(match);
+	hb_buffer_clear_contents(buffer);
+	hb_buffer_set_direction(buffer, HB_DIRECTION_LTR);
+	hb_buffer_add_utf32(buffer, (const uint32_t *)text, len, 0, len);
+	hb_buffer_guess_segment_properties(buffer);
+	hb_shape(font, buffer, features, LEN(features));
+	info = hb_buffer_get_glyph_infos(buffer, &count);
+	n = count;
+	pos = hb_buffer_get_glyph_positions(buffer, NULL);
+
+	if (len > r->size) {
+		r->size = len;
+		r->runes = xrealloc(r->runes, len * sizeof(Rune));
+		r->glyphs = xrealloc(r->glyphs, len * sizeof(Shaped));
+	}
+	r->hash = h;
+	r->match = match;
+	r->len = len;
+	memcpy(r->runes, text, len * sizeof(Rune));
+
+	/* cells swallowed by a ligature are left blank */
+	if (!hb_font_get_nominal_glyph(font, ' ', &space))
+		space = 0;
+	for (i = 0; i < len; i++)
+		r->glyphs[i] = (Shaped){ .glyph = space, .x = SHRT_MIN, .cell = i };
+
+	/*
+	 * Every cluster starts at the origin of its first cell, so the grid
+	 * holds even where the font's advances do not match the cells. The
+	 * glyphs of a cluster follow each other by their advances and take
+	 * the cells of the cluster in turn, extra ones are dropped.
+	 */
+	penx = peny = 0;
+	for (i = 0, cell = -1, e = 0; i < n; i++) {
+		c = info[i].cluster;
+		if (c < 0 || c >= len)
+			continue;
+		if (c != cell) {
+			for (k = i + 1; k < n && info[k].cluster == c; k++)
+				;
+			e = k < n && info[k].cluster > c ? info[k].cluster : len;
+			penx = peny = 0;
+			cell = c;
+		}
+		for (k = c; k < e && r->glyphs[k].x != SHRT_MIN; k++)
+			;
+		if (k < e) {
+			r->glyphs[k].glyph = info[i].codepoint;
+			r->glyphs[k].x = (penx + pos[i].x_offset) / 64;
+			r->glyphs[k].y = (peny + pos[i].y_offset) / 64;
+			r->glyphs[k].cell = c;
+		}
+		penx += pos[i].x_advance;
+		peny += pos[i].y_advance;
+	}
+	for (i = 0; i < len; i++) {
+		if (r->glyphs[i].x == SHRT_MIN)
+			r->glyphs[i].x = 0;
+	}
+
+	statstime(HIST_SHAPE, &start);
+
+	return r;
+}
+
+/*
+ * Replace the glyphs xmakeglyphfontspecs() picked one rune at a time
+ * with shaped ones. Runs of cells using the same font are shaped word
+ * by word, which keeps the cache hit rate high while lines change. A
+ * run ends where the colours or attributes do, a ligature must not
+ * swallow a cell drawn differently.
+ */
+void
+hbshape(XftGlyphFontSpec *specs, const Glyph *glyphs, int len, int x, int y)
+{
+	Shapedrun *r;
+	Shaped *g;
+	int i, j, n, end;
+
+	if (len > runeslen) {
+		runeslen = len;
+		runes = xrealloc(runes, len * sizeof(Rune));
+		cols = xrealloc(cols, len * sizeof(int));
+	}
+	for (i = n = 0; i < len; i++) {
+		if (glyphs[i].mode == ATTR_WDUMMY)
+			continue;
+		runes[n] = glyphs[i].mode & ATTR_IMAGE ? ' ' : glyphs[i].u;
+		cols[n++] = i;
+	}
+
+	for (i = 0; i < n; i = end) {
+		end = i + 1;
+		if (runes[i] == ' ')
+			continue;
+		while (end < n && specs[end].font == specs[i].font &&
+		       runes[end] != ' ' &&
+		       !ATTRCMP(glyphs[cols[i]], glyphs[cols[end]]) &&
+		       selected(x + cols[i], y) == selected(x + cols[end], y))
+			end++;
+		/* a single rune has nothing to shape */
+		if (end - i < 2)
+			continue;
+
+		/* backwards, a glyph is placed relative to an earlier cell */
+		r = hbshaperun(specs[i].font, runes + i, end - i);
+		for (j = end - i - 1; j >= 0; j--) {
+			g = &r->glyphs[j];
+			specs[i + j].glyph = g->glyph;
+			specs[i + j].x = specs[i + g->cell].x + g->x;
+			specs[i + j].y = specs[i + g->cell].y - g->y;
+		}
+	}
+}
@@ -0,0 +1,4 @@
+/* See LICENSE for license details. */
+
+void hbclear(void);
+void hbshape(XftGlyphFontSpec *, const Glyph *, int, int, int);
@@ -11,9 +11,11 @@
 #include <signal.h>
 #include <sys/ioctl.h>
 #include <sys/select.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 #include <wchar.h>
 
@@ -35,6 +37,8 @@
 #define ESC_ARG_SIZ   16
 #define STR_BUF_SIZ   ESC_BUF_SIZ
 #define STR_ARG_SIZ   ESC_ARG_SIZ
+#define VARINT_SIZ    10
+#define SIXEL_MAX     4096 /* largest image width and height */
 
 /* macros */
 #define IS_SET(flag)		((term.mode & (flag)) != 0)
@@ -42,6 +46,8 @@
 #define ISCONTROLC1(c)		(BETWEEN(c, 0x80, 0x9f))
 #define ISCONTROL(c)		(ISCONTROLC0(c) || ISCONTROLC1(c))
 #define ISDELIM(u)		(utf8strchr(worddelimiters, u) != NULL)
+#define COLORDIRTY(c)		(!IS_TRUECOL(c) && (c) < 256 && \
+				 term.palette[(c) / 32] & 1U << ((c) % 32))
 
 enum term_mode {
 	MODE_WRAP        = 1 << 0,
@@ -115,8 +121,11 @@ typedef struct {
 typedef struct {
 	int row;      /* nb row */
 	int col;      /* nb col */
+	int maxrow;   /* nb allocated rows */
+	int maxcol;   /* nb allocated cols */
 	Line *line;   /* screen */
-	Line *alt;    /* alternate screen */
+	Line *alt;    /* alternate screen, allocated on first use */
+	struct timespec altleft; /* when the alternate screen was left */
 	int *dirty;   /* dirtyness of lines */
 	TCursor c;    /* cursor */
 	int ocx;      /* old cursor col */
@@ -129,6 +138,8 @@ typedef struct {
 	int charset;  /* current charset */
 	int icharset; /* selected charset for sequence */
 	int *tabs;
+	uint32_t palette[256 / 32]; /* colors changed since the last frame */
+	int palettedirty;
 } Term;
 
 /* CSI Escape sequence structs */
@@ -152,10 +163,28 @@ typedef struct {
 	int narg;              /* nb of args */
 } STREscape;
 
+/* Sixel decoder state, fed one byte at a time */
+typedef struct {
+	uint32_t palette[256];
+	int color;
+	char cmd;              /* pending '#', '!' or '"' command */
+	int args[5];
+	int narg;
+	int repeat;
+	int x, y;              /* position, y is the top of the band */
+	int w, h;              /* extent of the image */
+	int bufw, bufh;        /* allocated size of pixels */
+	uint32_t *pixels;
+} Sixel;
+
 static void execsh(char *, char **);
 static void stty(char **);
 static void sigchld(int);
 static void ttywriteraw(const char *, size_t);
+static void ttyrecchunk(const char *, size_t);
+static void replaysession(FILE *, int, int);
+static size_t varintenc(uint64_t, uchar *);
+static int varintdec(FILE *, uint64_t *);
 
 static void csidump(void);
 static void csihandle(void);
@@ -166,6 +195,11 @@ static void strdump(void);
 static void strhandle(void);
 static void strparse(void);
 static void strreset(void);
+static void sixelstart(void);
+static void sixelput(Rune);
+static void sixelcmd(void);
+static void sixeldraw(int, int);
+static void sixelend(void);
 
 static void tprinter(char *, size_t);
 static void tdumpsel(void);
@@ -191,9 +225,13 @@ static void tsetchar(Rune, Glyph *, int, int);
 static void tsetdirt(int, int);
 static void tsetscroll(int, int);
 static void tswapscreen(void);
+static void taltalloc(void);
+static void taltfree(void);
+static void treverse(Line *, int, int);
 static void tsetmode(int, int, int *, int);
-static int twrite(const char *, int, int);
 static void tfulldirt(void);
+static void tsetdirtcolor(int);
+static void tflushcolors(void);
 static void tcontrolcode(uchar );
 static void tdectest(char );
 static void tdefutf8(char);
@@ -219,13 +257,18 @@ static char base64dec_getc(const char **);
 static ssize_t xwrite(int, const char *, size_t);
 
 /* Globals */
+Stats stats;
 static Term term;
 static Selection sel;
 static CSIEscape csiescseq;
 static STREscape strescseq;
+static Sixel sixel;
 static int iofd = 1;
 static int cmdfd;
 static pid_t pid;
+static int recfd = -1;
+static struct timespec reclast;
+static int replaying;
 
 static uchar utfbyte[UTF_SIZ + 1] = {0x80,    0, 0xC0, 0xE0, 0xF0};
 static uchar utfmask[UTF_SIZ + 1] = {0xC0, 0x80, 0xE0, 0xF0, 0xF8};
@@ -634,7 +677,8 @@ getsel(void)
 			if (gp->mode & ATTR_WDUMMY)
 				continue;
 
-			ptr += utf8encode(gp->u, ptr);
+			ptr += utf8encode((gp->mode & ATTR_IMAGE) ? ' ' : gp->u,
+			                  ptr);
 		}
 
 		/*
@@ -826,12 +870,17 @@ ttyread(void)
 {
 	static char buf[BUFSIZ];
 	static int buflen = 0;
+	struct timespec start;
 	int written;
 	int ret;
 
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
 	/* append read bytes to unprocessed bytes */
 	if ((ret = read(cmdfd, buf+buflen, LEN(buf)-buflen)) < 0)
 		die("couldn't read from shell: %s\n", strerror(errno));
+	if (recfd != -1 && ret > 0)
+		ttyrecchunk(buf+buflen, ret);
 	buflen += ret;
 
 	written = twrite(buf, buflen, 0);
@@ -840,9 +889,163 @@ ttyread(void)
 	if (buflen > 0)
 		memmove(buf, buf + written, buflen);
 
+	statstime(HIST_TTYREAD, &start);
+
 	return ret;
 }
 
+size_t
+varintenc(uint64_t v, uchar *buf)
+{
+	size_t n = 0;
+
+	do {
+		buf[n] = v & 0x7f;
+		v >>= 7;
+		if (v)
+			buf[n] |= 0x80;
+		n++;
+	} while (v);
+
+	return n;
+}
+
+int
+varintdec(FILE *f, uint64_t *v)
+{
+	int c, shift;
+
+	*v = 0;
+	for (shift = 0; shift < 7 * VARINT_SIZ; shift += 7) {
+		if ((c = getc(f)) == EOF)
+			return 0;
+		*v |= (uint64_t)(c & 0x7f) << shift;
+		if (!(c & 0x80))
+			return 1;
+	}
+
+	return 0;
+}
+
+void
+ttyrecord(char *path)
+{
+	if ((recfd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+		die("open record file '%s' failed: %s\n", path, strerror(errno));
+	if (xwrite(recfd, REC_MAGIC, strlen(REC_MAGIC)) < 0)
+		die("write error on record file: %s\n", strerror(errno));
+	clock_gettime(CLOCK_MONOTONIC, &reclast);
+}
+
+void
+ttyrecchunk(const char *s, size_t n)
+{
+	uchar hdr[2 * VARINT_SIZ];
+	struct timespec now;
+	size_t len;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	len = varintenc((now.tv_sec - reclast.tv_sec) * 1000000 +
+	                (now.tv_nsec - reclast.tv_nsec) / 1000, hdr);
+	len += varintenc(n, hdr + len);
+	reclast = now;
+
+	if (xwrite(recfd, (char *)hdr, len) < 0 || xwrite(recfd, s, n) < 0) {
+		perror("Error writing to record file");
+		close(recfd);
+		recfd = -1;
+	}
+}
+
+int
+ttyreplay(char *path, int realtime)
+{
+	char magic[sizeof(REC_MAGIC) - 1];
+	int sv[2];
+	FILE *f;
+
+	if (!(f = fopen(path, "r")))
+		die("open replay file '%s' failed: %s\n", path, strerror(errno));
+	if (fread(magic, 1, sizeof(magic), f) != sizeof(magic) ||
+	    memcmp(magic, REC_MAGIC, sizeof(magic)))
+		die("'%s' is not a st session recording\n", path);
+
+	/*
+	 * The recording is played by a child through a socket, so run()
+	 * sees it exactly like output of a program on the pty.
+	 */
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+		die("socketpair failed: %s\n", strerror(errno));
+
+	switch (pid = fork()) {
+	case -1:
+		die("fork failed: %s\n", strerror(errno));
+		break;
+	case 0:
+		close(iofd);
+		close(sv[0]);
+		replaysession(f, sv[1], realtime);
+		break;
+	default:
+		fclose(f);
+		close(sv[1]);
+		cmdfd = sv[0];
+		replaying = 1;
+		signal(SIGCHLD, sigchld);
+		break;
+	}
+	return cmdfd;
+}
+
+void
+replaysession(FILE *f, int fd, int realtime)
+{
+	char buf[BUFSIZ];
+	struct timespec start, next, end, nowait = {0};
+	uint64_t delay, len, total = 0;
+	size_t n;
+	fd_set rfd;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	next = start;
+	while (varintdec(f, &delay) && varintdec(f, &len)) {
+		if (realtime) {
+			next.tv_sec += delay / 1000000;
+			next.tv_nsec += delay % 1000000 * 1000;
+			if (next.tv_nsec >= 1E9) {
+				next.tv_sec++;
+				next.tv_nsec -= 1E9;
+			}
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+			                       &next, NULL) == EINTR)
+				/* nothing */ ;
+		}
+		for (; len > 0; len -= n) {
+			if (!(n = fread(buf, 1, MIN(len, sizeof(buf)), f)))
+				goto done;
+			if (xwrite(fd, buf, n) < 0)
+				_exit(1);
+			total += n;
+
+			/* throw away whatever st answered meanwhile */
+			FD_ZERO(&rfd);
+			FD_SET(fd, &rfd);
+			while (pselect(fd+1, &rfd, NULL, NULL, &nowait, NULL) > 0
+			       && read(fd, buf, sizeof(buf)) > 0)
+				FD_SET(fd, &rfd);
+		}
+	}
+done:
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	fprintf(stderr, "replay: %llu bytes in %.1f ms\n",
+	        (unsigned long long)total, TIMEDIFF(end, start));
+
+	/* keep the last frame on screen until st goes away */
+	while (read(fd, buf, sizeof(buf)) > 0)
+		/* nothing */ ;
+	_exit(0);
+}
+
 void
 ttywrite(const char *s, size_t n, int may_echo)
 {
@@ -933,6 +1136,9 @@ ttyresize(int tw, int th)
 {
 	struct winsize w;
 
+	if (replaying)
+		return;
+
 	w.ws_row = term.row;
 	w.ws_col = term.col;
 	w.ws_xpixel = tw;
@@ -996,6 +1202,47 @@ tfulldirt(void)
 	tsetdirt(0, term.row-1);
 }
 
+/*
+ * Palette changes are collected until the next frame, which only redraws
+ * the lines using one of the changed colors.
+ */
+void
+tsetdirtcolor(int x)
+{
+	/* the default and cursor colors are used everywhere */
+	if (x < 0 || x >= 256 || x == defaultfg || x == defaultbg) {
+		tfulldirt();
+		return;
+	}
+	term.palette[x / 32] |= 1U << (x % 32);
+	term.palettedirty = 1;
+}
+
+void
+tflushcolors(void)
+{
+	Glyph *gp;
+	int x, y;
+
+	for (y = 0; y < term.row; y++) {
+		if (term.dirty[y])
+			continue;
+		for (x = 0; x < term.col; x++) {
+			gp = &term.line[y][x];
+			/* bold may be drawn in the bright variant */
+			if (COLORDIRTY(gp->fg) || COLORDIRTY(gp->bg) ||
+			    (gp->mode & ATTR_BOLD && gp->fg < 8 &&
+			     COLORDIRTY(gp->fg + 8))) {
+				term.dirty[y] = 1;
+				break;
+			}
+		}
+	}
+
+	memset(term.palette, 0, sizeof(term.palette));
+	term.palettedirty = 0;
+}
+
 void
 tcursor(int mode)
 {
@@ -1034,6 +1281,8 @@ treset(void)
 		tmoveto(0, 0);
 		tcursor(CURSOR_SAVE);
 		tclearregion(0, 0, term.col-1, term.row-1);
+		if (!term.alt)
+			break;
 		tswapscreen();
 	}
 }
@@ -1049,14 +1298,42 @@ tnew(int col, int row)
 void
 tswapscreen(void)
 {
-	Line *tmp = term.line;
+	Line *tmp;
 
+	if (!term.alt)
+		taltalloc();
+	tmp = term.line;
 	term.line = term.alt;
 	term.alt = tmp;
 	term.mode ^= MODE_ALTSCREEN;
 	tfulldirt();
 }
 
+void
+taltalloc(void)
+{
+	Glyph g = { .u = ' ', .fg = defaultfg, .bg = defaultbg };
+	int i, j;
+
+	term.alt = xmalloc(term.maxrow * sizeof(Line));
+	for (i = 0; i < term.maxrow; i++) {
+		term.alt[i] = xmalloc(term.maxcol * sizeof(Glyph));
+		for (j = 0; j < term.maxcol; j++)
+			term.alt[i][j] = g;
+	}
+}
+
+void
+taltfree(void)
+{
+	int i;
+
+	for (i = 0; i < term.maxrow; i++)
+		free(term.alt[i]);
+	free(term.alt);
+	term.alt = NULL;
+}
+
 void
 tscrolldown(int orig, int n)
 {
@@ -1064,6 +1341,7 @@ tscrolldown(int orig, int n)
 	Line temp;
 
 	LIMIT(n, 0, term.bot-orig+1);
+	stats.scrolls++;
 
 	tsetdirt(orig, term.bot-n);
 	tclearregion(0, term.bot-n+1, term.col-1, term.bot);
@@ -1084,6 +1362,7 @@ tscrollup(int orig, int n)
 	Line temp;
 
 	LIMIT(n, 0, term.bot-orig+1);
+	stats.scrolls++;
 
 	tclearregion(0, orig, term.col-1, orig+n-1);
 	tsetdirt(orig+n, term.bot);
@@ -1555,6 +1834,9 @@ tsetmode(int priv, int set, int *args, int narg)
 				}
 				if (set ^ alt) /* set is always 1 or 0 */
 					tswapscreen();
+				if (!set)
+					clock_gettime(CLOCK_MONOTONIC,
+					              &term.altleft);
 				if (*args != 1049)
 					break;
 				/* FALLTHROUGH */
@@ -1611,6 +1893,8 @@ csihandle(void)
 	char buf[40];
 	int len;
 
+	stats.seq[SEQ_CSI]++;
+
 	switch (csiescseq.mode[0]) {
 	default:
 	unknown:
@@ -1850,6 +2134,8 @@ strhandle(void)
 	term.esc &= ~(ESC_STR_END|ESC_STR);
 	strparse();
 	par = (narg = strescseq.narg) ? atoi(strescseq.args[0]) : 0;
+	stats.seq[strescseq.type == ']' ? SEQ_OSC :
+	          strescseq.type == 'P' ? SEQ_DCS : SEQ_STR]++;
 
 	switch (strescseq.type) {
 	case ']': /* OSC -- Operating System Command */
@@ -1887,7 +2173,7 @@ strhandle(void)
 				 * TODO if defaultbg color is changed, borders
 				 * are dirty
 				 */
-				redraw();
+				tsetdirtcolor(j);
 			}
 			return;
 		}
@@ -1896,7 +2182,6 @@ strhandle(void)
 		xsettitle(strescseq.args[0]);
 		return;
 	case 'P': /* DCS -- Device Control String */
-		term.mode |= ESC_DCS;
 	case '_': /* APC -- Application Program Command */
 	case '^': /* PM -- Privacy Message */
 		return;
@@ -1961,6 +2246,196 @@ strreset(void)
 	memset(&strescseq, 0, sizeof(strescseq));
 }
 
+void
+sixelstart(void)
+{
+	/* VT340 default palette */
+	static const uint32_t vt340[] = {
+		0x000000, 0x3333cc, 0xcc2121, 0x33cc33,
+		0xcc33cc, 0x33cccc, 0xcccc33, 0x878787,
+		0x424242, 0x545499, 0x994242, 0x549954,
+		0x995499, 0x549999, 0x999954, 0xcccccc,
+	};
+	int i;
+
+	free(sixel.pixels);
+	memset(&sixel, 0, sizeof(sixel));
+	for (i = 0; i < LEN(vt340); i++)
+		sixel.palette[i] = 0xff000000 | vt340[i];
+	for (; i < LEN(sixel.palette); i++)
+		sixel.palette[i] = 0xff000000;
+}
+
+/*
+ * Sixel data is decoded as it arrives, only the pixels are kept. The
+ * numeric arguments of a command end with the next command or sixel.
+ */
+void
+sixelput(Rune u)
+{
+	if (BETWEEN(u, '0', '9')) {
+		if (sixel.cmd && sixel.args[sixel.narg] < SIXEL_MAX)
+			sixel.args[sixel.narg] = sixel.args[sixel.narg] * 10
+			                         + u - '0';
+		return;
+	}
+	if (u == ';') {
+		if (sixel.cmd && sixel.narg < LEN(sixel.args) - 1)
+			sixel.narg++;
+		return;
+	}
+
+	if (sixel.cmd)
+		sixelcmd();
+
+	switch (u) {
+	case '#': /* color introducer */
+	case '!': /* repeat introducer */
+	case '"': /* raster attributes */
+		sixel.cmd = u;
+		break;
+	case '$': /* graphics carriage return */
+		sixel.x = 0;
+		break;
+	case '-': /* graphics new line */
+		sixel.x = 0;
+		sixel.y += 6;
+		break;
+	default:
+		if (BETWEEN(u, 0x3f, 0x7e)) {
+			sixeldraw(u - 0x3f, MAX(sixel.repeat, 1));
+			sixel.repeat = 0;
+		}
+		break;
+	}
+}
+
+void
+sixelcmd(void)
+{
+	int *a = sixel.args, r, g, b, h, l, s, c, x;
+
+	switch (sixel.cmd) {
+	case '!':
+		sixel.repeat = a[0];
+		break;
+	case '"':
+		/* Pan;Pad;Ph;Pv, the size is only a hint */
+		if (sixel.narg >= 3) {
+			sixel.w = MAX(sixel.w, MIN(a[2], SIXEL_MAX));
+			sixel.h = MAX(sixel.h, MIN(a[3], SIXEL_MAX));
+		}
+		break;
+	case '#':
+		sixel.color = MIN(a[0], LEN(sixel.palette) - 1);
+		if (sixel.narg < 4)
+			break;
+		if (a[1] == 1) {
+			/* HLS, with blue at 0 degrees */
+			h = (a[2] + 240) % 360;
+			l = MIN(a[3], 100) * 255 / 100;
+			s = MIN(a[4], 100);
+			c = (100 - abs(2 * l * 100 / 255 - 100)) * s * 255 / 10000;
+			x = c * (60 - abs(h % 120 - 60)) / 60;
+			r = g = b = l - c / 2;
+			switch (h / 60) {
+			case 0: r += c; g += x; break;
+			case 1: r += x; g += c; break;
+			case 2: g += c; b += x; break;
+			case 3: g += x; b += c; break;
+			case 4: r += x; b += c; break;
+			default: r += c; b += x; break;
+			}
+		} else {
+			/* RGB in percent */
+			r = MIN(a[2], 100) * 255 / 100;
+			g = MIN(a[3], 100) * 255 / 100;
+			b = MIN(a[4], 100) * 255 / 100;
+		}
+		LIMIT(r, 0, 255);
+		LIMIT(g, 0, 255);
+		LIMIT(b, 0, 255);
+		sixel.palette[sixel.color] = 0xff000000 | r << 16 | g << 8 | b;
+		break;
+	}
+	sixel.cmd = 0;
+	sixel.narg = 0;
+	memset(sixel.args, 0, sizeof(sixel.args));
+}
+
+void
+sixeldraw(int bits, int n)
+{
+	uint32_t *buf, color = sixel.palette[sixel.color];
+	int i, y, w, h;
+
+	n = MIN(n, SIXEL_MAX - sixel.x);
+	if (n <= 0 || sixel.y + 6 > SIXEL_MAX) {
+		sixel.x += MAX(n, 0);
+		return;
+	}
+
+	/* grow geometrically, the image size is not known in advance */
+	if (sixel.x + n > sixel.bufw || sixel.y + 6 > sixel.bufh) {
+		w = MAX(sixel.x + n, sixel.bufw + sixel.bufw / 2);
+		h = MAX(sixel.y + 6, sixel.bufh + sixel.bufh / 2);
+		w = MIN(MAX(w, sixel.w), SIXEL_MAX);
+		h = MIN(MAX(h, sixel.h), SIXEL_MAX);
+		buf = xmalloc(w * h * sizeof(*buf));
+		memset(buf, 0, w * h * sizeof(*buf));
+		for (y = 0; y < sixel.bufh; y++) {
+			memcpy(buf + y * w, sixel.pixels + y * sixel.bufw,
+			       sixel.bufw * sizeof(*buf));
+		}
+		free(sixel.pixels);
+		sixel.pixels = buf;
+		sixel.bufw = w;
+		sixel.bufh = h;
+	}
+
+	for (y = 0; y < 6; y++) {
+		if (!(bits & 1 << y))
+			continue;
+		buf = sixel.pixels + (sixel.y + y) * sixel.bufw + sixel.x;
+		for (i = 0; i < n; i++)
+			buf[i] = color;
+	}
+	sixel.x += n;
+	sixel.w = MAX(sixel.w, sixel.x);
+	sixel.h = MAX(sixel.h, sixel.y + 6);
+}
+
+/* Hand the image to the window and put its tiles at the cursor. */
+void
+sixelend(void)
+{
+	Glyph attr;
+	int id, x, y, cols, rows;
+
+	if (sixel.cmd)
+		sixelcmd();
+	sixel.w = MIN(sixel.w, sixel.bufw);
+	sixel.h = MIN(sixel.h, sixel.bufh);
+	if (sixel.w > 0 && sixel.h > 0 &&
+	    (id = ximage(sixel.pixels, sixel.w, sixel.h, sixel.bufw,
+	                 &cols, &rows)) >= 0) {
+		attr = term.c.attr;
+		attr.mode = ATTR_IMAGE;
+		for (y = 0; y < rows; y++) {
+			if (y > 0)
+				tnewline(0);
+			for (x = 0; x < cols && term.c.x + x < term.col; x++) {
+				tsetchar(IMGREF(id, y, x), &attr,
+				         term.c.x + x, term.c.y);
+			}
+		}
+		tnewline(1);
+	}
+
+	free(sixel.pixels);
+	sixel.pixels = NULL;
+}
+
 void
 sendbreak(const Arg *arg)
 {
@@ -1996,6 +2471,75 @@ printsel(const Arg *arg)
 	tdumpsel();
 }
 
+void
+printstats(const Arg *arg)
+{
+	statsdump(stderr);
+}
+
+void
+statshist(int h, ulong v)
+{
+	int b;
+
+	for (b = 0; v && b < HIST_BUCKETS - 1; b++)
+		v >>= 1;
+	stats.hist[h][b]++;
+}
+
+void
+statstime(int h, const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	statshist(h, (now.tv_sec - start->tv_sec) * 1000000 +
+	             (now.tv_nsec - start->tv_nsec) / 1000);
+}
+
+void
+statsdump(FILE *f)
+{
+	static char *seqname[] = {
+		[SEQ_CTRL] = "ctrl", [SEQ_ESC] = "esc", [SEQ_CSI] = "csi",
+		[SEQ_OSC] = "osc", [SEQ_DCS] = "dcs", [SEQ_STR] = "str",
+	};
+	static char *histname[] = {
+		[HIST_TTYREAD] = "ttyread_us", [HIST_DRAW] = "draw_us",
+		[HIST_FINISHDRAW] = "xfinishdraw_us",
+		[HIST_DIRTYROWS] = "dirtyrows", [HIST_SHAPE] = "shape_us",
+		[HIST_LATENCY] = "latency_us",
+	};
+	int i, b;
+
+	fprintf(f, "bytes %lu\ntputc %lu\n", stats.bytes, stats.tputc);
+	for (i = 0; i < SEQ_LAST; i++)
+		fprintf(f, "seq_%s %lu\n", seqname[i], stats.seq[i]);
+	fprintf(f, "scrolls %lu\nframes %lu\ndirtyrows %lu\n"
+	        "font_main %lu\nfont_frchit %lu\nfont_frcmiss %lu\n"
+	        "shape_hit %lu\nshape_miss %lu\n",
+	        stats.scrolls, stats.frames, stats.dirtyrows,
+	        stats.fontmain, stats.frchit, stats.frcmiss,
+	        stats.shapehit, stats.shapemiss);
+
+	/* bucket b counts values below 2^b, the last one the rest */
+	for (i = 0; i < HIST_LAST; i++) {
+		fprintf(f, "%s", histname[i]);
+		for (b = 0; b < HIST_BUCKETS; b++) {
+			if (!stats.hist[i][b])
+				continue;
+			if (b < HIST_BUCKETS - 1)
+				fprintf(f, " <%lu:%lu", 1UL << b,
+				        stats.hist[i][b]);
+			else
+				fprintf(f, " >=%lu:%lu", 1UL << (b - 1),
+				        stats.hist[i][b]);
+		}
+		putc('\n', f);
+	}
+	fflush(f);
+}
+
 void
 tdumpsel(void)
 {
@@ -2017,7 +2561,8 @@ tdumpline(int n)
 	end = &bp[MIN(tlinelen(n), term.col) - 1];
 	if (bp != end || bp->u != ' ') {
 		for ( ;bp <= end; ++bp)
-			tprinter(buf, utf8encode(bp->u, buf));
+			tprinter(buf, utf8encode((bp->mode & ATTR_IMAGE) ?
+			                         ' ' : bp->u, buf));
 	}
 	tprinter("\n", 1);
 }
@@ -2092,6 +2637,8 @@ tstrsequence(uchar c)
 	switch (c) {
 	case 0x90:   /* DCS -- Device Control String */
 		c = 'P';
+		/* FALLTHROUGH */
+	case 'P':
 		term.esc |= ESC_DCS;
 		break;
 	case 0x9f:   /* APC -- Application Program Command */
@@ -2111,6 +2658,8 @@ tstrsequence(uchar c)
 void
 tcontrolcode(uchar ascii)
 {
+	stats.seq[SEQ_CTRL]++;
+
 	switch (ascii) {
 	case '\t':   /* HT */
 		tputtab(1);
@@ -2299,6 +2848,7 @@ tputc(Rune u)
 	int width, len;
 	Glyph *gp;
 
+	stats.tputc++;
 	control = ISCONTROL(u);
 	if (!IS_SET(MODE_UTF8) && !IS_SET(MODE_SIXEL)) {
 		c[0] = u;
@@ -2325,9 +2875,17 @@ tputc(Rune u)
 		   ISCONTROLC1(u)) {
 			term.esc &= ~(ESC_START|ESC_STR|ESC_DCS);
 			if (IS_SET(MODE_SIXEL)) {
-				/* TODO: render sixel */;
+				/* CAN and SUB cancel the DCS, the rest ends it */
+				if (u == 030 || u == 032) {
+					free(sixel.pixels);
+					sixel.pixels = NULL;
+				} else {
+					sixelend();
+				}
+				stats.seq[SEQ_DCS]++;
 				term.mode &= ~MODE_SIXEL;
-				return;
+				/* let ESC start the ST, which is ignored */
+				goto check_control_code;
 			}
 			term.esc |= ESC_STR_END;
 			goto check_control_code;
@@ -2335,11 +2893,16 @@ tputc(Rune u)
 
 
 		if (IS_SET(MODE_SIXEL)) {
-			/* TODO: implement sixel mode */
+			sixelput(u);
 			return;
 		}
-		if (term.esc&ESC_DCS && strescseq.len == 0 && u == 'q')
+		/* DCS P1;P2;P3 q */
+		if (term.esc&ESC_DCS && u == 'q' &&
+		    strspn(strescseq.buf, "0123456789;") == strescseq.len) {
 			term.mode |= MODE_SIXEL;
+			sixelstart();
+			return;
+		}
 
 		if (strescseq.len+len >= sizeof(strescseq.buf)-1) {
 			/*
@@ -2397,6 +2960,7 @@ check_control_code:
 				return;
 			/* sequence already finished */
 		}
+		stats.seq[SEQ_ESC]++;
 		term.esc = 0;
 		/*
 		 * All characters which form part of a sequence are not
@@ -2467,13 +3031,26 @@ twrite(const char *buf, int buflen, int show_ctrl)
 		}
 		tputc(u);
 	}
+	stats.bytes += n;
 	return n;
 }
 
+void
+treverse(Line *l, int start, int end)
+{
+	Line temp;
+
+	while (start < --end) {
+		temp = l[start];
+		l[start++] = l[end];
+		l[end] = temp;
+	}
+}
+
 void
 tresize(int col, int row)
 {
-	int i;
+	int i, n;
 	int minrow = MIN(row, term.row);
 	int mincol = MIN(col, term.col);
 	int *bp;
@@ -2486,41 +3063,51 @@ tresize(int col, int row)
 	}
 
 	/*
-	 * slide screen to keep cursor where we expect it -
-	 * tscrollup would work here, but we can optimize to
-	 * memmove because we're freeing the earlier lines
+	 * Lines are allocated with spare capacity, growing geometrically
+	 * and never shrinking, so that interactive resizing does not
+	 * reallocate on every step.
 	 */
-	for (i = 0; i <= term.c.y - row; i++) {
-		free(term.line[i]);
-		free(term.alt[i]);
-	}
-	/* ensure that both src and dst are not NULL */
-	if (i > 0) {
-		memmove(term.line, term.line + i, row * sizeof(Line));
-		memmove(term.alt, term.alt + i, row * sizeof(Line));
-	}
-	for (i += row; i < term.row; i++) {
-		free(term.line[i]);
-		free(term.alt[i]);
+	if (col > term.maxcol) {
+		n = MAX(col, term.maxcol + term.maxcol / 2);
+		for (i = 0; i < term.maxrow; i++) {
+			term.line[i] = xrealloc(term.line[i], n * sizeof(Glyph));
+			if (term.alt)
+				term.alt[i] = xrealloc(term.alt[i],
+				                       n * sizeof(Glyph));
+		}
+		term.tabs = xrealloc(term.tabs, n * sizeof(*term.tabs));
+		term.maxcol = n;
+	}
+	if (row > term.maxrow) {
+		n = MAX(row, term.maxrow + term.maxrow / 2);
+		term.line = xrealloc(term.line, n * sizeof(Line));
+		term.dirty = xrealloc(term.dirty, n * sizeof(*term.dirty));
+		for (i = term.maxrow; i < n; i++)
+			term.line[i] = xmalloc(term.maxcol * sizeof(Glyph));
+		if (term.alt) {
+			term.alt = xrealloc(term.alt, n * sizeof(Line));
+			for (i = term.maxrow; i < n; i++)
+				term.alt[i] = xmalloc(term.maxcol * sizeof(Glyph));
+		}
+		term.maxrow = n;
 	}
 
-	/* resize to new height */
-	term.line = xrealloc(term.line, row * sizeof(Line));
-	term.alt  = xrealloc(term.alt,  row * sizeof(Line));
-	term.dirty = xrealloc(term.dirty, row * sizeof(*term.dirty));
-	term.tabs = xrealloc(term.tabs, col * sizeof(*term.tabs));
-
-	/* resize each row to new width, zero-pad if needed */
-	for (i = 0; i < minrow; i++) {
-		term.line[i] = xrealloc(term.line[i], col * sizeof(Glyph));
-		term.alt[i]  = xrealloc(term.alt[i],  col * sizeof(Glyph));
+	/*
+	 * slide screen to keep cursor where we expect it -
+	 * the lines scrolled off the top are reused as spare
+	 * lines below the screen
+	 */
+	if ((n = term.c.y - row + 1) > 0) {
+		treverse(term.line, 0, n);
+		treverse(term.line, n, term.maxrow);
+		treverse(term.line, 0, term.maxrow);
+		if (term.alt) {
+			treverse(term.alt, 0, n);
+			treverse(term.alt, n, term.maxrow);
+			treverse(term.alt, 0, term.maxrow);
+		}
 	}
 
-	/* allocate any new rows */
-	for (/* i = minrow */; i < row; i++) {
-		term.line[i] = xmalloc(col * sizeof(Glyph));
-		term.alt[i] = xmalloc(col * sizeof(Glyph));
-	}
 	if (col > term.col) {
 		bp = term.tabs + term.col;
 
@@ -2546,6 +3133,8 @@ tresize(int col, int row)
 		if (0 < col && minrow < row) {
 			tclearregion(0, minrow, col - 1, row - 1);
 		}
+		if (!term.alt)
+			break;
 		tswapscreen();
 		tcursor(CURSOR_LOAD);
 	}
@@ -2561,24 +3150,38 @@ resettitle(void)
 void
 drawregion(int x1, int y1, int x2, int y2)
 {
-	int y;
+	int y, n = 0;
+
 	for (y = y1; y < y2; y++) {
 		if (!term.dirty[y])
 			continue;
 
 		term.dirty[y] = 0;
 		xdrawline(term.line[y], x1, y, x2);
+		n++;
 	}
+	stats.dirtyrows += n;
+	statshist(HIST_DIRTYROWS, n);
 }
 
 void
 draw(void)
 {
+	struct timespec start, finish;
 	int cx = term.c.x;
 
 	if (!xstartdraw())
 		return;
 
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (term.alt && !IS_SET(MODE_ALTSCREEN) && altscreenidle &&
+	    TIMEDIFF(start, term.altleft) > altscreenidle)
+		taltfree();
+
+	if (term.palettedirty)
+		tflushcolors();
+
 	/* adjust cursor position */
 	LIMIT(term.ocx, 0, term.col-1);
 	LIMIT(term.ocy, 0, term.row-1);
@@ -2591,7 +3194,11 @@ draw(void)
 	xdrawcursor(cx, term.c.y, term.line[term.c.y][cx],
 			term.ocx, term.ocy, term.line[term.ocy][term.ocx]);
 	term.ocx = cx, term.ocy = term.c.y;
+	clock_gettime(CLOCK_MONOTONIC, &finish);
 	xfinishdraw();
+	statstime(HIST_FINISHDRAW, &finish);
+	statstime(HIST_DRAW, &start);
+	stats.frames++;
 }
 
 void
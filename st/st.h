@@ -1,7 +1,9 @@
 /* See LICENSE for license details. */
 
 #include <stdint.h>
+#include <stdio.h>
 #include <sys/types.h>
+#include <time.h>
 
 /* macros */
 #define MIN(a, b)		((a) < (b) ? (a) : (b))
@@ -17,6 +19,19 @@
 				(t1.tv_nsec-t2.tv_nsec)/1E6)
 #define MODBIT(x, set, bit)	((set) ? ((x) |= (bit)) : ((x) &= ~(bit)))
 
+/* cells of an image keep a reference to a tile instead of a rune */
+#define IMGREF(id, row, col)	((Rune)(id) << 20 | (row) << 10 | (col))
+#define IMGID(u)		((u) >> 20)
+#define IMGROW(u)		((u) >> 10 & 0x3ff)
+#define IMGCOL(u)		((u) & 0x3ff)
+
+/*
+ * Session recordings start with REC_MAGIC, followed by one record per
+ * ttyread(): the delay since the previous read in microseconds and the
+ * length of the chunk, both as LEB128 varints, then the raw bytes.
+ */
+#define REC_MAGIC		"stRC"
+
 #define TRUECOLOR(r,g,b)	(1 << 24 | (r) << 16 | (g) << 8 | (b))
 #define IS_TRUECOL(x)		(1 << 24 & (x))
 
@@ -33,6 +48,7 @@ enum glyph_attribute {
 	ATTR_WRAP       = 1 << 8,
 	ATTR_WIDE       = 1 << 9,
 	ATTR_WDUMMY     = 1 << 10,
+	ATTR_IMAGE      = 1 << 11,
 	ATTR_BOLD_FAINT = ATTR_BOLD | ATTR_FAINT,
 };
 
@@ -57,6 +73,28 @@ typedef unsigned int uint;
 typedef unsigned long ulong;
 typedef unsigned short ushort;
 
+enum stat_seq {
+	SEQ_CTRL,
+	SEQ_ESC,
+	SEQ_CSI,
+	SEQ_OSC,
+	SEQ_DCS,
+	SEQ_STR, /* APC, PM and old title */
+	SEQ_LAST
+};
+
+enum stat_hist {
+	HIST_TTYREAD,    /* µs */
+	HIST_DRAW,       /* µs */
+	HIST_FINISHDRAW, /* µs */
+	HIST_DIRTYROWS,  /* rows per frame */
+	HIST_SHAPE,      /* µs per shaped run */
+	HIST_LATENCY,    /* µs from key press to the frame showing its echo */
+	HIST_LAST
+};
+
+#define HIST_BUCKETS	24
+
 typedef uint_least32_t Rune;
 
 #define Glyph Glyph_
@@ -69,6 +107,21 @@ typedef struct {
 
 typedef Glyph *Line;
 
+typedef struct {
+	ulong bytes;      /* bytes parsed */
+	ulong tputc;      /* tputc() calls */
+	ulong seq[SEQ_LAST];
+	ulong scrolls;
+	ulong frames;
+	ulong dirtyrows;
+	ulong fontmain;   /* glyphs found in the main faces */
+	ulong frchit;     /* fallback glyphs found in the font cache */
+	ulong frcmiss;    /* fallback glyphs looked up with fontconfig */
+	ulong shapehit;   /* runs found in the shaped run cache */
+	ulong shapemiss;  /* runs shaped with harfbuzz */
+	ulong hist[HIST_LAST][HIST_BUCKETS]; /* log2 buckets */
+} Stats;
+
 typedef union {
 	int i;
 	uint ui;
@@ -82,6 +135,7 @@ void draw(void);
 
 void printscreen(const Arg *);
 void printsel(const Arg *);
+void printstats(const Arg *);
 void sendbreak(const Arg *);
 void toggleprinter(const Arg *);
 
@@ -92,11 +146,18 @@ void tsetdirtattr(int);
 void ttyhangup(void);
 int ttynew(char *, char *, char *, char **);
 size_t ttyread(void);
+void ttyrecord(char *);
+int ttyreplay(char *, int);
 void ttyresize(int, int);
 void ttywrite(const char *, size_t, int);
+int twrite(const char *, int, int);
 
 void resettitle(void);
 
+void statsdump(FILE *);
+void statshist(int, ulong);
+void statstime(int, const struct timespec *);
+
 void selclear(void);
 void selinit(void);
 void selstart(int, int, int);
@@ -110,12 +171,15 @@ void *xmalloc(size_t);
 void *xrealloc(void *, size_t);
 char *xstrdup(char *);
 
+extern Stats stats;
+
 /* config.h globals */
 extern char *utmp;
 extern char *stty_args;
 extern char *vtiden;
 extern char *worddelimiters;
 extern int allowaltscreen;
+extern unsigned int altscreenidle;
 extern char *termname;
 extern unsigned int tabspaces;
 extern unsigned int alpha;
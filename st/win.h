@@ -32,6 +32,7 @@ void xclipcopy(void);
 void xdrawcursor(int, int, Glyph, int, int, Glyph);
 void xdrawline(Line, int, int, int);
 void xfinishdraw(void);
+int ximage(const uint32_t *, int, int, int, int *, int *);
 void xloadcols(void);
 int xsetcolorname(int, const char *);
 void xsettitle(char *);
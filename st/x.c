@@ -1,10 +1,18 @@
 /* See LICENSE for license details. */
+#ifdef __linux__
+#define _GNU_SOURCE /* struct ucred */
+#endif
+#include <ctype.h>
 #include <errno.h>
 #include <math.h>
 #include <limits.h>
 #include <locale.h>
 #include <signal.h>
 #include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
 #include <time.h>
 #include <unistd.h>
 #include <libgen.h>
@@ -19,6 +27,9 @@ static char *argv0;
 #include "arg.h"
 #include "st.h"
 #include "win.h"
+#ifdef HARFBUZZ
+#include "shape.h"
+#endif
 
 /* types used in config.h */
 typedef struct {
@@ -89,7 +100,9 @@ typedef struct {
 	Colormap cmap;
 	Window win;
 	Drawable buf;
+	int bufw, bufh; /* size of buf, may exceed the window */
 	GlyphFontSpec *specbuf; /* font spec buffer used for rendering */
+	int speclen; /* allocated length of specbuf */
 	Atom xembed, wmdeletewin, netwmname, netwmpid;
 	XIM xim;
 	XIC xic;
@@ -131,6 +144,7 @@ typedef struct {
 	Color *col;
 	size_t collen;
 	Font font, bfont, ifont, ibfont;
+	FcPattern *pattern; /* base pattern of the styled fonts */
 	GC gc;
 } DC;
 
@@ -138,17 +152,22 @@ static inline ushort sixd_to_16bit(int);
 static int xmakeglyphfontspecs(XftGlyphFontSpec *, const Glyph *, int, int, int);
 static void xdrawglyphfontspecs(const XftGlyphFontSpec *, Glyph, int, int, int);
 static void xdrawglyph(Glyph, int, int);
+static void xdrawimages(const Glyph *, int, int, int);
 static void xclear(int, int, int, int);
 static int xgeommasktogravity(int);
 static void xinit(int, int);
 static void cresize(int, int);
+static void wresize(int, int);
 static void xresize(int, int);
 static void xhints(void);
 static int xloadcolor(int, const char *, Color *);
 static int xloadfont(Font *, FcPattern *);
 static void xloadfonts(char *, double);
+static Font *xgetfont(int);
+static void xreopenfont(Font *);
 static void xunloadfont(Font *);
-static void xunloadfonts(void);
+static void xstashfonts(void);
+static int xrestorefonts(double);
 static void xsetenv(void);
 static void xseturgency(int);
 static int evcol(XEvent *);
@@ -175,7 +194,15 @@ static char *kmap(KeySym, uint);
 static int match(uint, uint);
 
 static void run(void);
+static void xevents(void);
+static void sigusr1(int);
 static void usage(void);
+static void parseargs(int, char *[]);
+static int peerok(int);
+static int sockaddr(struct sockaddr_un *, int);
+static int xclient(int, char *[]);
+static void xserve(void);
+static void xrecvrequest(int, int *, char ***);
 
 static void (*handler[LASTEvent])(XEvent *) = {
 	[KeyPress] = kpress,
@@ -209,6 +236,16 @@ static XWindow xw;
 static XSelection xsel;
 static TermWindow win;
 
+/* Images, cells refer to them through IMGREF(gen << 6 | slot, row, col) */
+typedef struct {
+	Picture pic;
+	int cw, ch;    /* cell size when the image was decoded */
+	uint gen;
+} Image;
+
+static Image images[64];
+static int imagesnext = 0;
+
 /* Font Ring Cache */
 enum {
 	FRC_NORMAL,
@@ -230,6 +267,44 @@ static char *usedfont = NULL;
 static double usedfontsize = 0;
 static double defaultfontsize = 0;
 
+/* Font sets of recently used sizes, most recent first, kept for zoom. */
+typedef struct {
+	double size;
+	Font font, bfont, ifont, ibfont;
+	FcPattern *pattern;
+	Fontcache frc[LEN(frc)];
+	int frclen;
+	ulong fbcfont;
+} Fontset;
+
+static Fontset fontsets[4];
+static int fontsetslen = 0;
+
+/*
+ * Persistent fallback cache: fontconfig's answer for a block of 256
+ * codepoints and a font style, kept on disk between runs.
+ */
+typedef struct {
+	ulong font;     /* hash of the font name and size */
+	Rune block;
+	int flags;
+	char *pattern;  /* unparsed, filtered fontconfig pattern */
+} Fallback;
+
+#define FBC_LEN 256
+
+static Fallback fbc[FBC_LEN];
+static int fbclen = 0;
+static ulong fbcconfig; /* hash of the fontconfig setup */
+static ulong fbcfont;
+static char *fbcpath = NULL;
+
+static ulong fnvhash(ulong, const void *, size_t);
+static void fbcinit(void);
+static XftFont *fbcfind(Rune, int);
+static void fbcadd(Rune, int, FcPattern *);
+static void fbcsave(void);
+
 static char *opt_class = NULL;
 static char **opt_cmd  = NULL;
 static char *opt_embed = NULL;
@@ -238,8 +313,26 @@ static char *opt_io    = NULL;
 static char *opt_line  = NULL;
 static char *opt_name  = NULL;
 static char *opt_title = NULL;
+static char *opt_record = NULL;
+static char *opt_replay = NULL;
+static int opt_replayfast = 0;
+static int opt_client = 0;
+static int opt_server = 0;
+
+static int clientfd = -1; /* client waiting for a window from the server */
 
 static int oldbutton = 3; /* button event on startup: 3 = release */
+static volatile sig_atomic_t statsrequest = 0;
+
+/* input latency, see kpress() and run() */
+static struct timespec xwake;   /* when X events were last readable */
+static struct timespec keytime; /* first key press not shown yet */
+static int keypending = 0, keyecho = 0;
+
+/* interactive resizing, see resize() */
+static int resizew = 0, resizeh = 0;
+static int ttyresizing = 0;
+static struct timespec lastresize;
 
 void
 clipcopy(const Arg *dummy)
@@ -291,8 +384,9 @@ zoom(const Arg *arg)
 void
 zoomabs(const Arg *arg)
 {
-	xunloadfonts();
-	xloadfonts(usedfont, arg->f);
+	xstashfonts();
+	if (arg->f <= 1 || !xrestorefonts(arg->f))
+		xloadfonts(usedfont, arg->f);
 	cresize(0, 0);
 	redraw();
 	xhints();
@@ -663,6 +757,15 @@ bmotion(XEvent *e)
 
 void
 cresize(int width, int height)
+{
+	wresize(width, height);
+	ttyresize(win.tw, win.th);
+	ttyresizing = 0;
+}
+
+/* Resize the window contents, without telling the tty. */
+void
+wresize(int width, int height)
 {
 	int col, row;
 
@@ -678,7 +781,6 @@ cresize(int width, int height)
 
 	tresize(col, row);
 	xresize(col, row);
-	ttyresize(win.tw, win.th);
 }
 
 void
@@ -687,14 +789,24 @@ xresize(int col, int row)
 	win.tw = col * win.cw;
 	win.th = row * win.ch;
 
-	XFreePixmap(xw.dpy, xw.buf);
-	xw.buf = XCreatePixmap(xw.dpy, xw.win, win.w, win.h,
-			xw.depth);
-	XftDrawChange(xw.draw, xw.buf);
+	/* keep some slack so that growing by a few cells is free */
+	if (win.w > xw.bufw || win.h > xw.bufh ||
+	    (win.w < xw.bufw / 2 && win.h < xw.bufh / 2)) {
+		xw.bufw = win.w + win.w / 4;
+		xw.bufh = win.h + win.h / 4;
+		XFreePixmap(xw.dpy, xw.buf);
+		xw.buf = XCreatePixmap(xw.dpy, xw.win, xw.bufw, xw.bufh,
+				xw.depth);
+		XftDrawChange(xw.draw, xw.buf);
+	}
 	xclear(0, 0, win.w, win.h);
 
 	/* resize to new width */
-	xw.specbuf = xrealloc(xw.specbuf, col * sizeof(GlyphFontSpec));
+	if (col > xw.speclen) {
+		xw.speclen = MAX(col, xw.speclen + xw.speclen / 2);
+		xw.specbuf = xrealloc(xw.specbuf,
+		                      xw.speclen * sizeof(GlyphFontSpec));
+	}
 }
 
 ushort
@@ -975,44 +1087,341 @@ xloadfonts(char *fontstr, double fontsize)
 	win.cw = ceilf(dc.font.width * cwscale);
 	win.ch = ceilf(dc.font.height * chscale);
 
-	FcPatternDel(pattern, FC_SLANT);
-	FcPatternAddInteger(pattern, FC_SLANT, FC_SLANT_ITALIC);
-	if (xloadfont(&dc.ifont, pattern))
-		die("can't open font %s\n", fontstr);
-
-	FcPatternDel(pattern, FC_WEIGHT);
-	FcPatternAddInteger(pattern, FC_WEIGHT, FC_WEIGHT_BOLD);
-	if (xloadfont(&dc.ibfont, pattern))
-		die("can't open font %s\n", fontstr);
+	/* the styled fonts are opened by xgetfont() when needed */
+	dc.pattern = pattern;
+	fbcfont = fnvhash(fnvhash(0, fontstr, strlen(fontstr)),
+	                  &usedfontsize, sizeof(usedfontsize));
+}
 
-	FcPatternDel(pattern, FC_SLANT);
-	FcPatternAddInteger(pattern, FC_SLANT, FC_SLANT_ROMAN);
-	if (xloadfont(&dc.bfont, pattern))
-		die("can't open font %s\n", fontstr);
+Font *
+xgetfont(int flags)
+{
+	Font *f;
+	FcPattern *pattern;
 
+	switch (flags) {
+	case FRC_ITALIC:
+		f = &dc.ifont;
+		break;
+	case FRC_BOLD:
+		f = &dc.bfont;
+		break;
+	case FRC_ITALICBOLD:
+		f = &dc.ibfont;
+		break;
+	default:
+		return &dc.font;
+	}
+	if (f->match)
+		return f;
+
+	if (!(pattern = FcPatternDuplicate(dc.pattern)))
+		die("can't open font %s\n", usedfont);
+	if (flags & FRC_ITALIC) {
+		FcPatternDel(pattern, FC_SLANT);
+		FcPatternAddInteger(pattern, FC_SLANT, FC_SLANT_ITALIC);
+	}
+	if (flags & FRC_BOLD) {
+		FcPatternDel(pattern, FC_WEIGHT);
+		FcPatternAddInteger(pattern, FC_WEIGHT, FC_WEIGHT_BOLD);
+	}
+	if (flags == FRC_BOLD) {
+		FcPatternDel(pattern, FC_SLANT);
+		FcPatternAddInteger(pattern, FC_SLANT, FC_SLANT_ROMAN);
+	}
+	if (xloadfont(f, pattern))
+		die("can't open font %s\n", usedfont);
 	FcPatternDestroy(pattern);
+
+	return f;
+}
+
+ulong
+fnvhash(ulong h, const void *p, size_t n)
+{
+	const uchar *s = p;
+
+	if (!h)
+		h = 2166136261UL;
+	while (n--)
+		h = (h ^ *s++) * 16777619UL;
+
+	return h;
+}
+
+void
+fbcinit(void)
+{
+	FcStrList *dirs[2];
+	FcChar8 *s;
+	struct stat st;
+	char *dir, line[BUFSIZ], *p;
+	Fallback *e;
+	FILE *f;
+	int i, n;
+
+	if (!fallbackcache)
+		return;
+
+	/* config files and font directories, with their mtimes */
+	fbcconfig = FcGetVersion();
+	dirs[0] = FcConfigGetConfigFiles(NULL);
+	dirs[1] = FcConfigGetFontDirs(NULL);
+	for (i = 0; i < LEN(dirs); i++) {
+		while (dirs[i] && (s = FcStrListNext(dirs[i]))) {
+			fbcconfig = fnvhash(fbcconfig, s, strlen((char *)s));
+			if (!stat((char *)s, &st))
+				fbcconfig = fnvhash(fbcconfig, &st.st_mtime,
+				                    sizeof(st.st_mtime));
+		}
+		if (dirs[i])
+			FcStrListDone(dirs[i]);
+	}
+
+	if ((dir = getenv("XDG_CACHE_HOME")))
+		n = snprintf(line, sizeof(line), "%s/%s", dir, fallbackcache);
+	else if ((dir = getenv("HOME")))
+		n = snprintf(line, sizeof(line), "%s/.cache/%s", dir,
+		             fallbackcache);
+	else
+		return;
+	if (n < 0 || n >= sizeof(line))
+		return;
+	fbcpath = xstrdup(line);
+
+	if (!(f = fopen(fbcpath, "r")))
+		return;
+	if (!fgets(line, sizeof(line), f) ||
+	    strtoul(line, NULL, 16) != fbcconfig) {
+		/* fonts or configuration changed, start over */
+		fclose(f);
+		return;
+	}
+	while (fbclen < FBC_LEN && fgets(line, sizeof(line), f)) {
+		e = &fbc[fbclen];
+		if (sscanf(line, "%lx %x %d %n", &e->font, &e->block,
+		           &e->flags, &n) != 3)
+			continue;
+		if ((p = strchr(line + n, '\n')))
+			*p = '\0';
+		e->pattern = xstrdup(line + n);
+		fbclen++;
+	}
+	fclose(f);
+}
+
+XftFont *
+fbcfind(Rune rune, int flags)
+{
+	FcPattern *pattern;
+	XftFont *font;
+	int i;
+
+	for (i = 0; i < fbclen; i++) {
+		if (fbc[i].font != fbcfont || fbc[i].block != rune >> 8 ||
+		    fbc[i].flags != flags)
+			continue;
+		if (!(pattern = FcNameParse((FcChar8 *)fbc[i].pattern)))
+			return NULL;
+		if (!(font = XftFontOpenPattern(xw.dpy, pattern))) {
+			FcPatternDestroy(pattern);
+			return NULL;
+		}
+		/* a neighbour from the same block may not be covered */
+		if (!XftCharIndex(xw.dpy, font, rune)) {
+			XftFontClose(xw.dpy, font);
+			return NULL;
+		}
+		return font;
+	}
+
+	return NULL;
+}
+
+void
+fbcadd(Rune rune, int flags, FcPattern *pattern)
+{
+	FcObjectSet *os;
+	FcPattern *filtered;
+	FcChar8 *name;
+	Fallback *e;
+	int i;
+
+	if (!fbcpath)
+		return;
+
+	/* drop what is only needed for matching, like the charset */
+	os = FcObjectSetBuild(FC_FILE, FC_INDEX, FC_FAMILY, FC_STYLE,
+	                      FC_SLANT, FC_WEIGHT, FC_WIDTH, FC_PIXEL_SIZE,
+	                      FC_SIZE, FC_DPI, FC_SCALABLE, FC_ANTIALIAS,
+	                      FC_HINTING, FC_HINT_STYLE, FC_AUTOHINT,
+	                      FC_RGBA, FC_LCD_FILTER, FC_EMBOLDEN,
+	                      FC_MATRIX, (char *)NULL);
+	filtered = FcPatternFilter(pattern, os);
+	FcObjectSetDestroy(os);
+	if (!filtered)
+		return;
+	name = FcNameUnparse(filtered);
+	FcPatternDestroy(filtered);
+	if (!name)
+		return;
+
+	for (i = 0; i < fbclen; i++) {
+		if (fbc[i].font == fbcfont && fbc[i].block == rune >> 8 &&
+		    fbc[i].flags == flags)
+			break;
+	}
+	if (i == fbclen) {
+		if (fbclen == FBC_LEN) {
+			/* evict the oldest entry */
+			free(fbc[0].pattern);
+			memmove(fbc, fbc + 1, (FBC_LEN - 1) * sizeof(*fbc));
+			fbclen--;
+		}
+		i = fbclen++;
+	} else {
+		free(fbc[i].pattern);
+	}
+	e = &fbc[i];
+	e->font = fbcfont;
+	e->block = rune >> 8;
+	e->flags = flags;
+	e->pattern = xstrdup((char *)name);
+	free(name);
+
+	fbcsave();
+}
+
+void
+fbcsave(void)
+{
+	char tmp[PATH_MAX], *p;
+	FILE *f;
+	int i;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.%d", fbcpath, (int)getpid())
+	    >= sizeof(tmp))
+		return;
+	if (!(f = fopen(tmp, "w"))) {
+		/* the cache directory may not exist yet */
+		if (!(p = strrchr(tmp, '/')))
+			return;
+		*p = '\0';
+		mkdir(tmp, 0700);
+		*p = '/';
+		if (!(f = fopen(tmp, "w")))
+			return;
+	}
+
+	fprintf(f, "%lx\n", fbcconfig);
+	for (i = 0; i < fbclen; i++) {
+		fprintf(f, "%lx %x %d %s\n", fbc[i].font, fbc[i].block,
+		        fbc[i].flags, fbc[i].pattern);
+	}
+	if (fclose(f) || rename(tmp, fbcpath))
+		unlink(tmp);
+}
+
+/*
+ * Open a font matched by the server process again on this connection,
+ * skipping all fontconfig work.
+ */
+void
+xreopenfont(Font *f)
+{
+	if (!f->match)
+		return;
+	if (!(f->match = XftFontOpenPattern(xw.dpy,
+			FcPatternDuplicate(f->match->pattern))))
+		die("can't reopen font\n");
 }
 
 void
 xunloadfont(Font *f)
 {
+	if (!f->match)
+		return;
+
 	XftFontClose(xw.dpy, f->match);
 	FcPatternDestroy(f->pattern);
 	if (f->set)
 		FcFontSetDestroy(f->set);
+	memset(f, 0, sizeof(*f));
 }
 
+/* Move the current fonts to the front of fontsets, evicting the oldest. */
 void
-xunloadfonts(void)
+xstashfonts(void)
+{
+	Fontset *fs;
+
+	if (fontsetslen == LEN(fontsets)) {
+		/* Free the loaded fonts in the font cache.  */
+#ifdef HARFBUZZ
+		hbclear();
+#endif
+		fs = &fontsets[--fontsetslen];
+		while (fs->frclen > 0)
+			XftFontClose(xw.dpy, fs->frc[--fs->frclen].font);
+		xunloadfont(&fs->font);
+		xunloadfont(&fs->bfont);
+		xunloadfont(&fs->ifont);
+		xunloadfont(&fs->ibfont);
+		FcPatternDestroy(fs->pattern);
+	}
+	memmove(fontsets + 1, fontsets, fontsetslen * sizeof(*fontsets));
+	fontsetslen++;
+
+	fs = &fontsets[0];
+	fs->size = usedfontsize;
+	fs->font = dc.font;
+	fs->bfont = dc.bfont;
+	fs->ifont = dc.ifont;
+	fs->ibfont = dc.ibfont;
+	fs->pattern = dc.pattern;
+	memcpy(fs->frc, frc, sizeof(frc));
+	fs->frclen = frclen;
+	fs->fbcfont = fbcfont;
+
+	memset(&dc.font, 0, sizeof(dc.font));
+	memset(&dc.bfont, 0, sizeof(dc.bfont));
+	memset(&dc.ifont, 0, sizeof(dc.ifont));
+	memset(&dc.ibfont, 0, sizeof(dc.ibfont));
+	dc.pattern = NULL;
+	frclen = 0;
+}
+
+/* Take the font set of the given size out of fontsets, if it is there. */
+int
+xrestorefonts(double size)
 {
-	/* Free the loaded fonts in the font cache.  */
-	while (frclen > 0)
-		XftFontClose(xw.dpy, frc[--frclen].font);
+	Fontset *fs;
+	int i;
+
+	for (i = 0; i < fontsetslen && fontsets[i].size != size; i++)
+		;
+	if (i == fontsetslen)
+		return 0;
+
+	fs = &fontsets[i];
+	usedfontsize = fs->size;
+	dc.font = fs->font;
+	dc.bfont = fs->bfont;
+	dc.ifont = fs->ifont;
+	dc.ibfont = fs->ibfont;
+	dc.pattern = fs->pattern;
+	memcpy(frc, fs->frc, sizeof(frc));
+	frclen = fs->frclen;
+	fbcfont = fs->fbcfont;
+
+	win.cw = ceilf(dc.font.width * cwscale);
+	win.ch = ceilf(dc.font.height * chscale);
 
-	xunloadfont(&dc.font);
-	xunloadfont(&dc.bfont);
-	xunloadfont(&dc.ifont);
-	xunloadfont(&dc.ibfont);
+	fontsetslen--;
+	memmove(fontsets + i, fontsets + i + 1,
+	        (fontsetslen - i) * sizeof(*fontsets));
+
+	return 1;
 }
 
 void
@@ -1063,11 +1472,20 @@ xinit(int cols, int rows)
 	}
 
 	/* font */
-	if (!FcInit())
-		die("could not init fontconfig.\n");
+	if (dc.font.match && !strcmp(usedfont, opt_font ? opt_font : font)) {
+		/* inherited from the server */
+		xreopenfont(&dc.font);
+		xreopenfont(&dc.bfont);
+		xreopenfont(&dc.ifont);
+		xreopenfont(&dc.ibfont);
+	} else {
+		if (!FcInit())
+			die("could not init fontconfig.\n");
 
-	usedfont = (opt_font == NULL)? font : opt_font;
-	xloadfonts(usedfont, 0);
+		usedfont = (opt_font == NULL)? font : opt_font;
+		xloadfonts(usedfont, 0);
+		fbcinit();
+	}
 
 	/* colors */
 	if (!USE_ARGB)
@@ -1104,6 +1522,8 @@ xinit(int cols, int rows)
 	memset(&gcvalues, 0, sizeof(gcvalues));
 	gcvalues.graphics_exposures = False;
 	xw.buf = XCreatePixmap(xw.dpy, xw.win, win.w, win.h, xw.depth);
+	xw.bufw = win.w;
+	xw.bufh = win.h;
 	dc.gc = XCreateGC(xw.dpy, (USE_ARGB) ? xw.buf: parent,
 			GCGraphicsExposures, &gcvalues);
 	XSetForeground(xw.dpy, dc.gc, dc.col[defaultbg].pixel);
@@ -1111,6 +1531,7 @@ xinit(int cols, int rows)
 
 	/* font spec buffer */
 	xw.specbuf = xmalloc(cols * sizeof(GlyphFontSpec));
+	xw.speclen = cols;
 
 	/* Xft rendering context */
 	xw.draw = XftDrawCreate(xw.dpy, xw.buf, xw.vis, xw.cmap);
@@ -1195,6 +1616,8 @@ xmakeglyphfontspecs(XftGlyphFontSpec *specs, const Glyph *glyphs, int len, int x
 		/* Fetch rune and mode for current glyph. */
 		rune = glyphs[i].u;
 		mode = glyphs[i].mode;
+		if (mode & ATTR_IMAGE)
+			rune = ' ';
 
 		/* Skip dummy wide-character spacing. */
 		if (mode == ATTR_WDUMMY)
@@ -1203,25 +1626,23 @@ xmakeglyphfontspecs(XftGlyphFontSpec *specs, const Glyph *glyphs, int len, int x
 		/* Determine font for glyph if different from previous glyph. */
 		if (prevmode != mode) {
 			prevmode = mode;
-			font = &dc.font;
 			frcflags = FRC_NORMAL;
 			runewidth = win.cw * ((mode & ATTR_WIDE) ? 2.0f : 1.0f);
 			if ((mode & ATTR_ITALIC) && (mode & ATTR_BOLD)) {
-				font = &dc.ibfont;
 				frcflags = FRC_ITALICBOLD;
 			} else if (mode & ATTR_ITALIC) {
-				font = &dc.ifont;
 				frcflags = FRC_ITALIC;
 			} else if (mode & ATTR_BOLD) {
-				font = &dc.bfont;
 				frcflags = FRC_BOLD;
 			}
+			font = xgetfont(frcflags);
 			yp = winy + font->ascent;
 		}
 
 		/* Lookup character index with default font. */
 		glyphidx = XftCharIndex(xw.dpy, font->match, rune);
 		if (glyphidx) {
+			stats.fontmain++;
 			specs[numspecs].font = font->match;
 			specs[numspecs].glyph = glyphidx;
 			specs[numspecs].x = (short)xp;
@@ -1245,48 +1666,63 @@ xmakeglyphfontspecs(XftGlyphFontSpec *specs, const Glyph *glyphs, int len, int x
 		}
 
 		/* Nothing was found. Use fontconfig to find matching font. */
-		if (f >= frclen) {
-			if (!font->set)
-				font->set = FcFontSort(0, font->pattern,
-				                       1, 0, &fcres);
-			fcsets[0] = font->set;
-
-			/*
-			 * Nothing was found in the cache. Now use
-			 * some dozen of Fontconfig calls to get the
-			 * font for one single character.
-			 *
-			 * Xft and fontconfig are design failures.
-			 */
-			fcpattern = FcPatternDuplicate(font->pattern);
-			fccharset = FcCharSetCreate();
-
-			FcCharSetAddChar(fccharset, rune);
-			FcPatternAddCharSet(fcpattern, FC_CHARSET,
-					fccharset);
-			FcPatternAddBool(fcpattern, FC_SCALABLE, 1);
-
-			FcConfigSubstitute(0, fcpattern,
-					FcMatchPattern);
-			FcDefaultSubstitute(fcpattern);
-
-			fontpattern = FcFontSetMatch(0, fcsets, 1,
-					fcpattern, &fcres);
+		if (f < frclen) {
+			stats.frchit++;
+		} else {
+			stats.frcmiss++;
 
 			/*
 			 * Overwrite or create the new cache entry.
 			 */
 			if (frclen >= LEN(frc)) {
 				frclen = LEN(frc) - 1;
+#ifdef HARFBUZZ
+				hbclear();
+#endif
 				XftFontClose(xw.dpy, frc[frclen].font);
 				frc[frclen].unicodep = 0;
 			}
 
-			frc[frclen].font = XftFontOpenPattern(xw.dpy,
-					fontpattern);
-			if (!frc[frclen].font)
-				die("XftFontOpenPattern failed seeking fallback font: %s\n",
-					strerror(errno));
+			/* Try what fontconfig answered in earlier runs. */
+			if (!(frc[frclen].font = fbcfind(rune, frcflags))) {
+				if (!font->set)
+					font->set = FcFontSort(0, font->pattern,
+					                       1, 0, &fcres);
+				fcsets[0] = font->set;
+
+				/*
+				 * Nothing was found in the cache. Now use
+				 * some dozen of Fontconfig calls to get the
+				 * font for one single character.
+				 *
+				 * Xft and fontconfig are design failures.
+				 */
+				fcpattern = FcPatternDuplicate(font->pattern);
+				fccharset = FcCharSetCreate();
+
+				FcCharSetAddChar(fccharset, rune);
+				FcPatternAddCharSet(fcpattern, FC_CHARSET,
+						fccharset);
+				FcPatternAddBool(fcpattern, FC_SCALABLE, 1);
+
+				FcConfigSubstitute(0, fcpattern,
+						FcMatchPattern);
+				FcDefaultSubstitute(fcpattern);
+
+				fontpattern = FcFontSetMatch(0, fcsets, 1,
+						fcpattern, &fcres);
+
+				frc[frclen].font = XftFontOpenPattern(xw.dpy,
+						fontpattern);
+				if (!frc[frclen].font)
+					die("XftFontOpenPattern failed seeking fallback font: %s\n",
+						strerror(errno));
+				if (XftCharIndex(xw.dpy, frc[frclen].font, rune))
+					fbcadd(rune, frcflags, fontpattern);
+
+				FcPatternDestroy(fcpattern);
+				FcCharSetDestroy(fccharset);
+			}
 			frc[frclen].flags = frcflags;
 			frc[frclen].unicodep = rune;
 
@@ -1294,9 +1730,6 @@ xmakeglyphfontspecs(XftGlyphFontSpec *specs, const Glyph *glyphs, int len, int x
 
 			f = frclen;
 			frclen++;
-
-			FcPatternDestroy(fcpattern);
-			FcCharSetDestroy(fccharset);
 		}
 
 		specs[numspecs].font = frc[f].font;
@@ -1453,6 +1886,82 @@ xdrawglyph(Glyph g, int x, int y)
 
 	numspecs = xmakeglyphfontspecs(&spec, &g, 1, x, y);
 	xdrawglyphfontspecs(&spec, g, numspecs, x, y);
+	xdrawimages(&g, 1, x, y);
+}
+
+/*
+ * Upload an image once; its tiles are composited over the cells in
+ * xdrawimages(). The oldest image is dropped when all slots are used,
+ * cells still pointing to it stay blank.
+ */
+int
+ximage(const uint32_t *pixels, int w, int h, int stride, int *cols, int *rows)
+{
+	XRenderPictFormat *fmt;
+	XImage *img;
+	Pixmap pm;
+	GC gc;
+	Image *im;
+	int slot, one = 1;
+
+	if (!(fmt = XRenderFindStandardFormat(xw.dpy, PictStandardARGB32)))
+		return -1;
+	if (!(img = XCreateImage(xw.dpy, xw.vis, 32, ZPixmap, 0,
+	                         (char *)pixels, w, h, 32, stride * 4)))
+		return -1;
+	img->byte_order = *(char *)&one ? LSBFirst : MSBFirst;
+
+	pm = XCreatePixmap(xw.dpy, xw.win, w, h, 32);
+	gc = XCreateGC(xw.dpy, pm, 0, NULL);
+	XPutImage(xw.dpy, pm, gc, img, 0, 0, 0, 0, w, h);
+	XFreeGC(xw.dpy, gc);
+	img->data = NULL; /* owned by the caller */
+	XDestroyImage(img);
+
+	slot = imagesnext;
+	imagesnext = (imagesnext + 1) % LEN(images);
+	im = &images[slot];
+	if (im->pic)
+		XRenderFreePicture(xw.dpy, im->pic);
+	im->pic = XRenderCreatePicture(xw.dpy, pm, fmt, 0, NULL);
+	XFreePixmap(xw.dpy, pm);
+	im->cw = win.cw;
+	im->ch = win.ch;
+	/* never 0, IMGREF(0, 0, col) would look like plain text */
+	im->gen = im->gen % 63 + 1;
+
+	*cols = MIN(DIVCEIL(w, win.cw), 1024);
+	*rows = MIN(DIVCEIL(h, win.ch), 1024);
+
+	return im->gen << 6 | slot;
+}
+
+void
+xdrawimages(const Glyph *glyphs, int len, int x, int y)
+{
+	Image *im;
+	Rune u;
+	int i, n;
+
+	for (i = 0; i < len; i += n) {
+		n = 1;
+		if (!(glyphs[i].mode & ATTR_IMAGE))
+			continue;
+		u = glyphs[i].u;
+		im = &images[IMGID(u) % LEN(images)];
+		if (!im->pic || im->gen != IMGID(u) >> 6)
+			continue;
+
+		/* adjacent tiles of the same image are drawn at once */
+		while (i + n < len && glyphs[i + n].mode & ATTR_IMAGE &&
+		       glyphs[i + n].u == u + n)
+			n++;
+		XRenderComposite(xw.dpy, PictOpOver, im->pic, None,
+		                 XftDrawPicture(xw.draw),
+		                 IMGCOL(u) * im->cw, IMGROW(u) * im->ch, 0, 0,
+		                 borderpx + (x + i) * win.cw,
+		                 borderpx + y * win.ch, n * win.cw, win.ch);
+	}
 }
 
 void
@@ -1471,6 +1980,8 @@ xdrawcursor(int cx, int cy, Glyph g, int ox, int oy, Glyph og)
 	/*
 	 * Select the right color for the right mode.
 	 */
+	if (g.mode & ATTR_IMAGE)
+		g.u = ' ';
 	g.mode &= ATTR_BOLD|ATTR_ITALIC|ATTR_UNDERLINE|ATTR_STRUCK|ATTR_WIDE;
 
 	if (IS_SET(MODE_REVERSE)) {
@@ -1576,6 +2087,9 @@ xdrawline(Line line, int x1, int y1, int x2)
 	XftGlyphFontSpec *specs = xw.specbuf;
 
 	numspecs = xmakeglyphfontspecs(specs, &line[x1], x2 - x1, x1, y1);
+#ifdef HARFBUZZ
+	hbshape(specs, &line[x1], x2 - x1, x1, y1);
+#endif
 	i = ox = 0;
 	for (x = x1; x < x2 && i < numspecs; x++) {
 		new = line[x];
@@ -1597,6 +2111,7 @@ xdrawline(Line line, int x1, int y1, int x2)
 	}
 	if (i > 0)
 		xdrawglyphfontspecs(specs, base, i, ox, y1);
+	xdrawimages(&line[x1], x2 - x1, x1, y1);
 }
 
 void
@@ -1753,6 +2268,11 @@ kpress(XEvent *ev)
 	if (IS_SET(MODE_KBDLOCK))
 		return;
 
+	if (!keypending) {
+		keytime = xwake;
+		keypending = 1;
+	}
+
 	len = XmbLookupString(xw.xic, e, buf, sizeof buf, &ksym, &status);
 	/* 1. shortcuts */
 	for (bp = shortcuts; bp < shortcuts + LEN(shortcuts); bp++) {
@@ -1807,13 +2327,36 @@ cmessage(XEvent *e)
 	}
 }
 
+/*
+ * Window managers send a storm of these while the window is resized
+ * interactively. Only the last size is applied, once per frame in run(),
+ * and the tty is told only once the size settled for resizedelay.
+ */
 void
 resize(XEvent *e)
 {
-	if (e->xconfigure.width == win.w && e->xconfigure.height == win.h)
-		return;
+	resizew = e->xconfigure.width;
+	resizeh = e->xconfigure.height;
+}
+
+void
+xevents(void)
+{
+	XEvent ev;
+
+	while (XPending(xw.dpy)) {
+		XNextEvent(xw.dpy, &ev);
+		if (XFilterEvent(&ev, None))
+			continue;
+		if (handler[ev.type])
+			(handler[ev.type])(&ev);
+	}
+}
 
-	cresize(e->xconfigure.width, e->xconfigure.height);
+void
+sigusr1(int unused)
+{
+	statsrequest = 1;
 }
 
 void
@@ -1824,8 +2367,9 @@ run(void)
 	fd_set rfd;
 	int xfd = XConnectionNumber(xw.dpy), xev, blinkset = 0, dodraw = 0;
 	int ttyfd;
-	struct timespec drawtimeout, *tv = NULL, now, last, lastblink;
+	struct timespec drawtimeout, *tv = NULL, now, last, lastblink, laststats;
 	long deltatime;
+	FILE *sf;
 
 	/* Waiting for window mapping */
 	do {
@@ -1843,13 +2387,25 @@ run(void)
 		}
 	} while (ev.type != MapNotify);
 
-	ttyfd = ttynew(opt_line, shell, opt_io, opt_cmd);
+	if (opt_record)
+		ttyrecord(opt_record);
+	if (opt_replay)
+		ttyfd = ttyreplay(opt_replay, !opt_replayfast);
+	else
+		ttyfd = ttynew(opt_line, shell, opt_io, opt_cmd);
 	cresize(w, h);
 
+	signal(SIGUSR1, sigusr1);
+
 	clock_gettime(CLOCK_MONOTONIC, &last);
-	lastblink = last;
+	lastblink = laststats = last;
 
 	for (xev = actionfps;;) {
+		if (statsrequest) {
+			statsrequest = 0;
+			printstats(NULL);
+		}
+
 		FD_ZERO(&rfd);
 		FD_SET(ttyfd, &rfd);
 		FD_SET(xfd, &rfd);
@@ -1859,8 +2415,15 @@ run(void)
 				continue;
 			die("select failed: %s\n", strerror(errno));
 		}
+		if (FD_ISSET(xfd, &rfd)) {
+			clock_gettime(CLOCK_MONOTONIC, &xwake);
+			/* pass key presses on to the tty right away */
+			if (lowlatency)
+				xevents();
+		}
 		if (FD_ISSET(ttyfd, &rfd)) {
 			ttyread();
+			keyecho = keypending;
 			if (blinktimeout) {
 				blinkset = tattrset(ATTR_BLINK);
 				if (!blinkset)
@@ -1883,24 +2446,55 @@ run(void)
 			lastblink = now;
 			dodraw = 1;
 		}
+		/* only rewritten while busy, idle stats don't change */
+		if (statsfile && TIMEDIFF(now, laststats) > statsinterval) {
+			if ((sf = fopen(statsfile, "w"))) {
+				statsdump(sf);
+				fclose(sf);
+			} else {
+				fprintf(stderr, "Couldn't write stats file: %s\n",
+				        strerror(errno));
+				statsfile = NULL;
+			}
+			laststats = now;
+		}
+
+		/* key presses that were never echoed are forgotten */
+		if (keypending && !keyecho && TIMEDIFF(now, keytime) > 1000)
+			keypending = 0;
+
 		deltatime = TIMEDIFF(now, last);
-		if (deltatime > 1000 / (xev ? xfps : actionfps)) {
+		if (deltatime > 1000 / (xev ? xfps : actionfps) ||
+		    (lowlatency && keyecho)) {
 			dodraw = 1;
 			last = now;
 		}
 
 		if (dodraw) {
-			while (XPending(xw.dpy)) {
-				XNextEvent(xw.dpy, &ev);
-				if (XFilterEvent(&ev, None))
-					continue;
-				if (handler[ev.type])
-					(handler[ev.type])(&ev);
+			xevents();
+
+			if (resizew) {
+				if (resizew != win.w || resizeh != win.h) {
+					wresize(resizew, resizeh);
+					ttyresizing = 1;
+					lastresize = now;
+				}
+				resizew = resizeh = 0;
+			}
+			if (ttyresizing &&
+			    TIMEDIFF(now, lastresize) > resizedelay) {
+				ttyresize(win.tw, win.th);
+				ttyresizing = 0;
 			}
 
 			draw();
 			XFlush(xw.dpy);
 
+			if (keyecho) {
+				statstime(HIST_LATENCY, &keytime);
+				keypending = keyecho = 0;
+			}
+
 			if (xev && !FD_ISSET(xfd, &rfd))
 				xev--;
 			if (!FD_ISSET(ttyfd, &rfd) && !FD_ISSET(xfd, &rfd)) {
@@ -1917,7 +2511,7 @@ run(void)
 					drawtimeout.tv_sec = \
 					    drawtimeout.tv_nsec / 1E9;
 					drawtimeout.tv_nsec %= (long)1E9;
-				} else {
+				} else if (!ttyresizing) {
 					tv = NULL;
 				}
 			}
@@ -1930,25 +2524,241 @@ usage(void)
 {
 	die("usage: %s [-aiv] [-c class] [-f font] [-g geometry]"
 	    " [-n name] [-o file]\n"
-	    "          [-T title] [-t title] [-w windowid]"
+	    "          [-R recfile] [-T title] [-t title] [-w windowid]"
 	    " [[-e] command [args ...]]\n"
 	    "       %s [-aiv] [-c class] [-f font] [-g geometry]"
 	    " [-n name] [-o file]\n"
-	    "          [-T title] [-t title] [-w windowid] -l line"
-	    " [stty_args ...]\n", argv0, argv0);
+	    "          [-R recfile] [-T title] [-t title] [-w windowid]"
+	    " -l line [stty_args ...]\n"
+	    "       %s [-aiv] [-c class] [-f font] [-g geometry]"
+	    " [-n name] [-T title]\n"
+	    "          [-t title] [-w windowid] -p|-P recfile\n"
+	    "       %s -S [-a] [-f font]\n"
+	    "       %s -C [options ...]\n",
+	    argv0, argv0, argv0, argv0, argv0);
 }
 
+/* Only talk to st processes running as ourselves. */
 int
-main(int argc, char *argv[])
+peerok(int fd)
 {
-	xw.l = xw.t = 0;
-	xw.isfixed = False;
-	win.cursor = cursorshape;
+#ifdef __linux__
+	struct ucred cred;
+	socklen_t len = sizeof(cred);
+
+	return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 &&
+	       cred.uid == getuid();
+#else
+	uid_t uid;
+	gid_t gid;
+
+	return getpeereid(fd, &uid, &gid) == 0 && uid == getuid();
+#endif
+}
 
+/*
+ * The socket lives in a directory only we can enter: XDG_RUNTIME_DIR or
+ * /tmp/st-<uid>, which the server creates. Anything else could be bound
+ * by another user first and collect our clients' environment.
+ */
+int
+sockaddr(struct sockaddr_un *addr, int create)
+{
+	char dir[PATH_MAX], disp[64], *env;
+	struct stat st;
+	int i, n;
+
+	if (!(env = getenv("DISPLAY")))
+		return 0;
+	for (i = 0; env[i] && i < sizeof(disp) - 1; i++)
+		disp[i] = isalnum((unsigned char)env[i]) || env[i] == '.' ||
+		          env[i] == ':' ? env[i] : '_';
+	disp[i] = '\0';
+
+	if ((env = getenv("XDG_RUNTIME_DIR")))
+		n = snprintf(dir, sizeof(dir), "%s", env);
+	else
+		n = snprintf(dir, sizeof(dir), "/tmp/st-%d", (int)getuid());
+	if (n < 0 || n >= sizeof(dir))
+		return 0;
+	if (create && !env && mkdir(dir, 0700) < 0 && errno != EEXIST)
+		return 0;
+	if (lstat(dir, &st) < 0 || !S_ISDIR(st.st_mode) ||
+	    st.st_uid != getuid() || (st.st_mode & 077))
+		return 0;
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+	n = snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/st-%s",
+	             dir, disp);
+
+	return n > 0 && n < sizeof(addr->sun_path);
+}
+
+/*
+ * Ask a running st -S to open a window for us. The request is a sequence
+ * of NUL terminated strings: working directory, argument count, the
+ * arguments and the environment. The server answers with a single byte
+ * once the window exists.
+ */
+int
+xclient(int argc, char *argv[])
+{
+	extern char **environ;
+	struct sockaddr_un addr;
+	char cwd[PATH_MAX], n[16], **sp;
+	FILE *f;
+	int fd, i;
+
+	if (!sockaddr(&addr, 0) || (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		return 0;
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+	    !peerok(fd) || !(f = fdopen(fd, "r+"))) {
+		close(fd);
+		return 0;
+	}
+
+	if (!getcwd(cwd, sizeof(cwd)))
+		strcpy(cwd, "/");
+	snprintf(n, sizeof(n), "%d", argc);
+	fprintf(f, "%s%c%s%c", cwd, '\0', n, '\0');
+	for (i = 0; i < argc; i++)
+		fprintf(f, "%s%c", argv[i], '\0');
+	for (sp = environ; *sp; sp++)
+		fprintf(f, "%s%c", *sp, '\0');
+	fflush(f);
+	shutdown(fd, SHUT_WR);
+
+	i = getc(f);
+	fclose(f);
+
+	return i != EOF;
+}
+
+void
+xrecvrequest(int fd, int *argc, char ***argv)
+{
+	extern char **environ;
+	char *buf = NULL, *p, **strs;
+	size_t len = 0;
+	ssize_t r;
+	int n, nstr;
+
+	do {
+		buf = xrealloc(buf, len + BUFSIZ + 1);
+		if ((r = read(fd, buf + len, BUFSIZ)) < 0)
+			die("couldn't read request: %s\n", strerror(errno));
+		len += r;
+	} while (r > 0);
+	buf[len] = '\0';
+
+	for (nstr = 0, p = buf; p < buf + len; p += strlen(p) + 1)
+		nstr++;
+	strs = xmalloc((nstr + 1) * sizeof(*strs));
+	for (nstr = 0, p = buf; p < buf + len; p += strlen(p) + 1)
+		strs[nstr++] = p;
+	strs[nstr] = NULL;
+
+	if (nstr < 3 || (n = atoi(strs[1])) < 1 || n > nstr - 2)
+		die("bad request from client\n");
+
+	if (chdir(strs[0]) < 0)
+		fprintf(stderr, "chdir %s: %s\n", strs[0], strerror(errno));
+
+	/* arguments and environment have to be NULL terminated */
+	*argc = n;
+	*argv = xmalloc((n + 1) * sizeof(**argv));
+	memcpy(*argv, strs + 2, n * sizeof(**argv));
+	(*argv)[n] = NULL;
+	environ = strs + 2 + n;
+}
+
+/*
+ * Server mode: connect to X, initialize fontconfig and match the fonts
+ * once, then fork a terminal for every client. The children inherit the
+ * matched fonts and fontconfig state, so they only reopen the faces on
+ * their own connection. Returns in each child.
+ */
+void
+xserve(void)
+{
+	struct sockaddr_un addr;
+	int sfd, cfd, argc;
+	char **argv;
+	mode_t mask;
+
+	setlocale(LC_CTYPE, "");
+	if (!(xw.dpy = XOpenDisplay(NULL)))
+		die("can't open display\n");
+	xw.scr = XDefaultScreen(xw.dpy);
+	if (!FcInit())
+		die("could not init fontconfig.\n");
+	usedfont = (opt_font == NULL)? font : opt_font;
+	xloadfonts(usedfont, 0);
+	xgetfont(FRC_ITALIC);
+	xgetfont(FRC_BOLD);
+	xgetfont(FRC_ITALICBOLD);
+	fbcinit();
+
+	if (!sockaddr(&addr, 1))
+		die("can't make a private socket path for this display\n");
+	if ((sfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		die("socket failed: %s\n", strerror(errno));
+	unlink(addr.sun_path);
+	mask = umask(077);
+	if (bind(sfd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		die("bind %s failed: %s\n", addr.sun_path, strerror(errno));
+	umask(mask);
+	if (listen(sfd, 16) < 0)
+		die("listen failed: %s\n", strerror(errno));
+
+	/* terminals are reaped automatically */
+	signal(SIGCHLD, SIG_IGN);
+
+	for (;;) {
+		if ((cfd = accept(sfd, NULL, NULL)) < 0) {
+			if (errno == EINTR)
+				continue;
+			die("accept failed: %s\n", strerror(errno));
+		}
+		if (!peerok(cfd)) {
+			close(cfd);
+			continue;
+		}
+
+		switch (fork()) {
+		case -1:
+			perror("fork failed");
+			break;
+		case 0:
+			/* never talk over the server's X connection */
+			close(XConnectionNumber(xw.dpy));
+			close(sfd);
+			setsid();
+			signal(SIGCHLD, SIG_DFL);
+
+			xrecvrequest(cfd, &argc, &argv);
+			parseargs(argc, argv);
+			clientfd = cfd;
+			return;
+		}
+		close(cfd);
+	}
+}
+
+void
+parseargs(int argc, char *argv[])
+{
 	ARGBEGIN {
 	case 'a':
 		allowaltscreen = 0;
 		break;
+	case 'C':
+		opt_client = 1;
+		break;
+	case 'S':
+		opt_server = 1;
+		break;
 	case 'c':
 		opt_class = EARGF(usage());
 		break;
@@ -1975,6 +2785,15 @@ main(int argc, char *argv[])
 	case 'n':
 		opt_name = EARGF(usage());
 		break;
+	case 'P':
+		opt_replayfast = 1;
+		/* FALLTHROUGH */
+	case 'p':
+		opt_replay = EARGF(usage());
+		break;
+	case 'R':
+		opt_record = EARGF(usage());
+		break;
 	case 't':
 	case 'T':
 		opt_title = EARGF(usage());
@@ -1992,9 +2811,23 @@ main(int argc, char *argv[])
 run:
 	if (argc > 0) /* eat all remaining arguments */
 		opt_cmd = argv;
+}
+
+int
+main(int argc, char *argv[])
+{
+	xw.l = xw.t = 0;
+	xw.isfixed = False;
+	win.cursor = cursorshape;
+
+	parseargs(argc, argv);
+	if (opt_client && xclient(argc, argv))
+		return 0;
+	if (opt_server)
+		xserve();
 
 	if (!opt_title)
-		opt_title = (opt_line || !opt_cmd) ? "st" : opt_cmd[0];
+		opt_title = (opt_line || opt_replay || !opt_cmd) ? "st" : opt_cmd[0];
 
 	setlocale(LC_CTYPE, "");
 	XSetLocaleModifiers("");
@@ -2004,6 +2837,12 @@ run:
 	xinit(cols, rows);
 	xsetenv();
 	selinit();
+	if (clientfd != -1) {
+		/* the window is there, let the client go */
+		if (write(clientfd, "", 1) < 0)
+			perror("couldn't answer client");
+		close(clientfd);
+	}
 	run();
 
 	return 0;